@@ -10,6 +10,14 @@ DPI_MODEL_CFLAGS=-MMD -MP -O2 -g -fpic -std=c++11 -I$(INSTALL_DIR)/include
 DPI_MODEL_LDFLAGS=-O2 -g -shared -L$(INSTALL_DIR)/lib
 
 DPI_MODEL_CFLAGS += -Werror -Wfatal-errors
+
+# Remove traces above this level from the models at compile time
+ifdef DPI_TRACE_MAX_LEVEL
+DPI_MODEL_CFLAGS += -DDPI_TRACE_MAX_LEVEL=$(DPI_TRACE_MAX_LEVEL)
+endif
+ifdef DPI_STATS
+DPI_MODEL_CFLAGS += -DDPI_STATS=$(DPI_STATS)
+endif
 DPI_MODEL_LDFLAGS += -Werror -Wfatal-errors
 
 
@@ -24,4 +24,9 @@
 #define DPI_DLLESPEC
 typedef uint8_t svLogic;
 
+// Without simulator, open arrays are directly passed as C buffers
+typedef void *svOpenArrayHandle;
+
+static inline void *svGetArrayPtr(const svOpenArrayHandle h) { return h; }
+
 #endif
\ No newline at end of file
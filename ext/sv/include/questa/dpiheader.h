@@ -138,6 +138,14 @@ dpi_model_load(
     void* comp_config,
     void* handle);
 
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_model_load_many(
+    int nb_models,
+    const svOpenArrayHandle configs,
+    const svOpenArrayHandle handles,
+    const svOpenArrayHandle models);
+
 DPI_LINK_DECL DPI_DLLESPEC
 int
 dpi_model_start(
@@ -148,6 +156,30 @@ int
 dpi_model_stop(
     void* model);
 
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_model_mem_write(
+    void* model,
+    uint64_t addr,
+    const svOpenArrayHandle data,
+    int size);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_model_mem_read(
+    void* model,
+    uint64_t addr,
+    const svOpenArrayHandle data,
+    int size);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_model_mem_load_file(
+    void* model,
+    const char* path,
+    const char* format,
+    uint64_t base);
+
 DPI_LINK_DECL DPI_DLLESPEC
 void*
 dpi_qspim_bind(
@@ -162,6 +194,13 @@ dpi_gpio_bind(
     const char* name,
     int handle);
 
+DPI_LINK_DECL DPI_DLLESPEC
+void*
+dpi_hyper_bind(
+    void* dpi_model,
+    const char* name,
+    int handle);
+
 DPI_LINK_DECL DPI_DLLESPEC
 int
 dpi_qspim_cs_edge(
@@ -194,6 +233,119 @@ dpi_qspim_edge(
     int mask);
 
 
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_qspim_octal_sck_edge(
+    void* handle,
+    int64_t timestamp,
+    int sck,
+    int data,
+    int mask);
+
+DPI_LINK_DECL DPI_DLLESPEC
+void
+dpi_qspim_octal_edge(
+    void* handle,
+    int64_t timestamp,
+    int data,
+    int mask);
+
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_qspim_transfer(
+    void* handle,
+    int64_t timestamp,
+    int64_t period,
+    uint64_t cmd,
+    int cmd_bits,
+    int cmd_lanes,
+    uint64_t addr,
+    int addr_bits,
+    int addr_lanes,
+    int dummy_cycles,
+    int data_lanes,
+    int is_write,
+    int size,
+    const svOpenArrayHandle data);
+
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_qspim_sck_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    int mask,
+    const svOpenArrayHandle out);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_qspim_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    int mask,
+    const svOpenArrayHandle out);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_qspim_octal_sck_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    int mask,
+    const svOpenArrayHandle out);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_hyper_cs_edge(
+    void* handle,
+    int64_t timestamp,
+    int cs);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_hyper_ck_edge(
+    void* handle,
+    int64_t timestamp,
+    int ck,
+    int rwds,
+    int data,
+    int mask);
+
+DPI_LINK_DECL DPI_DLLESPEC
+void
+dpi_hyper_edge(
+    void* handle,
+    int64_t timestamp,
+    int rwds,
+    int data,
+    int mask);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_hyper_ck_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    int mask,
+    const svOpenArrayHandle out);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_hyper_transfer(
+    void* handle,
+    int64_t timestamp,
+    int64_t period,
+    uint64_t cmd_addr,
+    int size,
+    const svOpenArrayHandle data);
+
 DPI_LINK_DECL DPI_DLLESPEC
 void
 dpi_gpio_edge(
@@ -271,6 +423,33 @@ dpi_i2s_edge(
     int ws,
     int sd);
 
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_uart_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    const svOpenArrayHandle out);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_i2c_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    const svOpenArrayHandle out);
+
+DPI_LINK_DECL DPI_DLLESPEC
+int
+dpi_i2s_edges(
+    void* handle,
+    const svOpenArrayHandle timestamps,
+    const svOpenArrayHandle pins,
+    int nb_edges,
+    const svOpenArrayHandle out);
+
 DPI_LINK_DECL void
 dpi_i2c_rx_edge(
     int handle,
@@ -341,6 +520,19 @@ dpi_qspim_set_qpi_data(
     int data_3,
     int mask);
 
+DPI_LINK_DECL void
+dpi_qspim_set_octal_data(
+    int handle,
+    int data,
+    int mask);
+
+DPI_LINK_DECL void
+dpi_hyper_set_data(
+    int handle,
+    int rwds,
+    int data,
+    int mask);
+
 DPI_LINK_DECL int
 dpi_raise_event(
     void* handle);
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __DPI_BINARY_TRACE_HPP__
+#define __DPI_BINARY_TRACE_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Binary trace format
+ *
+ * Instead of formatting trace messages, models can dump them as fixed-size
+ * records into a memory-mapped ring buffer. Each record contains the format
+ * string id, the timestamp and the raw arguments. The strings (format
+ * strings, trace names and string arguments) are appended to a separate
+ * file (<path>.str) as (id, length, characters) entries.
+ * The text is rebuilt offline with dpi_trace_decode.
+ */
+
+#define DPI_BINARY_TRACE_MAGIC    0x54425044
+#define DPI_BINARY_TRACE_VERSION  1
+#define DPI_BINARY_TRACE_MAX_ARGS 8
+
+typedef enum {
+  DPI_BINARY_TRACE_ARG_INT    = 0,
+  DPI_BINARY_TRACE_ARG_DOUBLE = 1,
+  DPI_BINARY_TRACE_ARG_STR    = 2
+} dpi_binary_trace_arg_e;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t nb_records;
+  // Total number of records written since the beginning, the next record
+  // is written at index nb_written % nb_records
+  uint64_t nb_written;
+} dpi_binary_trace_header_t;
+
+typedef struct {
+  int64_t timestamp;
+  uint32_t format_id;
+  uint16_t trace_id;
+  uint8_t level;
+  uint8_t nb_args;
+  // 2 bits per argument, see dpi_binary_trace_arg_e
+  uint32_t arg_types;
+  uint32_t padding;
+  uint64_t args[DPI_BINARY_TRACE_MAX_ARGS];
+} dpi_binary_trace_record_t;
+
+typedef struct {
+  uint32_t id;
+  uint32_t len;
+} dpi_binary_trace_str_t;
+
+
+
+class Dpi_binary_trace
+{
+public:
+  Dpi_binary_trace(std::string path, int nb_records);
+  ~Dpi_binary_trace();
+
+  bool is_open() { return this->records != NULL; }
+
+  void flush();
+
+  // Strings coming from literals (format strings) are cached by pointer,
+  // others are cached by content
+  uint32_t get_static_str_id(const char *str);
+  uint32_t get_str_id(const char *str);
+
+  template<typename... Args>
+  inline void dump(int64_t timestamp, int trace_id, int level, const char *format, Args... args)
+  {
+    dpi_binary_trace_record_t *record = &this->records[this->header->nb_written % this->nb_records];
+    this->header->nb_written++;
+
+    record->timestamp = timestamp;
+    record->format_id = this->get_static_str_id(format);
+    record->trace_id = trace_id;
+    record->level = level;
+    record->nb_args = 0;
+    record->arg_types = 0;
+    this->pack(record, args...);
+  }
+
+private:
+  uint32_t new_str(const char *str);
+
+  inline void pack(dpi_binary_trace_record_t *record) {}
+
+  template<typename T, typename... Args>
+  inline void pack(dpi_binary_trace_record_t *record, T arg, Args... args)
+  {
+    this->pack_arg(record, arg);
+    this->pack(record, args...);
+  }
+
+  inline void push_arg(dpi_binary_trace_record_t *record, dpi_binary_trace_arg_e type, uint64_t value)
+  {
+    if (record->nb_args == DPI_BINARY_TRACE_MAX_ARGS)
+      return;
+    record->arg_types |= type << (record->nb_args * 2);
+    record->args[record->nb_args++] = value;
+  }
+
+  template<typename T>
+  inline void pack_arg(dpi_binary_trace_record_t *record, T arg)
+  {
+    this->push_arg(record, DPI_BINARY_TRACE_ARG_INT, (uint64_t)(int64_t)arg);
+  }
+
+  inline void pack_arg(dpi_binary_trace_record_t *record, double arg)
+  {
+    union { double d; uint64_t u; } value = { .d=arg };
+    this->push_arg(record, DPI_BINARY_TRACE_ARG_DOUBLE, value.u);
+  }
+
+  inline void pack_arg(dpi_binary_trace_record_t *record, float arg)
+  {
+    this->pack_arg(record, (double)arg);
+  }
+
+  inline void pack_arg(dpi_binary_trace_record_t *record, const char *arg)
+  {
+    this->push_arg(record, DPI_BINARY_TRACE_ARG_STR, this->get_str_id(arg));
+  }
+
+  inline void pack_arg(dpi_binary_trace_record_t *record, char *arg)
+  {
+    this->pack_arg(record, (const char *)arg);
+  }
+
+  inline void pack_arg(dpi_binary_trace_record_t *record, void *arg)
+  {
+    this->push_arg(record, DPI_BINARY_TRACE_ARG_INT, (uint64_t)arg);
+  }
+
+  dpi_binary_trace_header_t *header;
+  dpi_binary_trace_record_t *records;
+  uint32_t nb_records;
+  size_t map_size;
+  FILE *str_file;
+  uint32_t nb_str;
+  std::unordered_map<const char *, uint32_t> static_strs;
+  std::unordered_map<std::string, uint32_t> strs;
+};
+
+#endif
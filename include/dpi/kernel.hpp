@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __DPI_KERNEL_HPP__
+#define __DPI_KERNEL_HPP__
+
+#include <json.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <functional>
+
+#include "dpi/tb_driver.h"
+
+/*
+ * Standalone event kernel
+ *
+ * This library (libpulpdpikernel.so) implements all the functions that the
+ * models import from the SystemVerilog testbench (dpi_wait, dpi_create_task,
+ * dpi_time, dpi_qspim_set_data, ...), so that models can be loaded and run
+ * from a C++ testbench without any HDL simulator.
+ *
+ * Time is in picoseconds like on the HDL side. Model tasks are executed as
+ * ucontext coroutines, scheduled from a single time-ordered event queue.
+ *
+ * Typical usage:
+ *
+ *   Dpi_kernel kernel;
+ *   void *model = kernel.load_model(comp_config);
+ *   void *qspi = kernel.bind(model, "input", &my_qspi_pins);
+ *   kernel.start();
+ *   kernel.post(1000, [=]() { dpi_qspim_cs_edge(qspi, kernel.get_time(), 0); });
+ *   kernel.run(1000000);
+ *   kernel.stop();
+ */
+
+
+// Receives the pins driven by a model on one of its interfaces. The testbench
+// overloads the methods matching the interface type.
+class Dpi_kernel_itf
+{
+public:
+  virtual void qspim_set_data(int data) {}
+  virtual void qspim_set_qpi_data(int data_0, int data_1, int data_2, int data_3, int mask) {}
+  virtual void qspim_set_octal_data(int data, int mask) {}
+  virtual void hyper_set_data(int rwds, int data, int mask) {}
+  virtual void gpio_set_data(int data) {}
+  virtual void uart_rx_edge(int data) {}
+  virtual void i2c_rx_edge(int sda) {}
+  virtual void i2s_rx_edge(int sck, int ws, int sd) {}
+  virtual void cpi_edge(int pclk, int href, int vsync, int data) {}
+  virtual void jtag_tck_edge(int tck, int tdi, int tms, int trst, int *tdo) {}
+  virtual void ctrl_reset_edge(int reset) {}
+  virtual void ctrl_config_edge(int config) {}
+};
+
+
+class Dpi_kernel_task;
+class Dpi_kernel_comp;
+
+class Dpi_kernel
+{
+public:
+  Dpi_kernel(int64_t stack_size=1024*1024);
+  ~Dpi_kernel();
+
+  // Load the model described by the given component configuration, through
+  // model_load, and return its handle
+  void *load_model(js::config *config);
+  // Load several models at once, see dpi_model_load_many. Return an empty
+  // vector if any of them could not be loaded
+  std::vector<void *> load_models(std::vector<js::config *> configs);
+
+  // Bind the model interface with the given name and return the interface
+  // handle to be given to the dpi_*_edge functions, or NULL if the model has
+  // no such interface
+  void *bind(void *model, std::string name, Dpi_kernel_itf *itf);
+
+  void start();
+  void stop();
+
+  // Execute events until the given amount of time has elapsed, until there is
+  // no more event or until a model reports a fatal error.
+  // Return the current time
+  int64_t run(int64_t duration);
+
+  int64_t get_time() { return this->time; }
+  bool has_failed() { return this->failed; }
+  void set_trace_level(int level) { this->trace_level = level; }
+  // Drop the messages printed by the models, fatal errors are still reported
+  void set_quiet(bool quiet) { this->quiet = quiet; }
+
+  // Execute the callback after the given delay, for testbench stimuli
+  void post(int64_t delay, std::function<void()> callback);
+
+  // Implementation of the functions imported by the models
+  void create_task(Dpi_kernel_comp *comp, int id);
+  void create_periodic_handler(int id, int64_t period);
+  void wait(int64_t delay);
+  void wait_event(std::vector<std::pair<Dpi_kernel_task *, uint64_t>> *waiters, int64_t timeout);
+  void raise_event(std::vector<std::pair<Dpi_kernel_task *, uint64_t>> *waiters);
+  void raise_event_from_ext(Dpi_kernel_comp *comp);
+  void print(Dpi_kernel_comp *comp, const char *msg);
+  void fatal(Dpi_kernel_comp *comp, const char *msg);
+  void trace_msg(std::string *trace, int level, const char *msg);
+  Dpi_kernel_itf *get_itf(int handle);
+
+private:
+  class Dpi_kernel_event
+  {
+  public:
+    int64_t time;
+    uint64_t seq;
+    std::function<void()> callback;
+    bool operator<(const Dpi_kernel_event &other) const
+    {
+      // Reversed as std::priority_queue pops the biggest element
+      return time > other.time || (time == other.time && seq > other.seq);
+    }
+  };
+
+  static void task_entry();
+  void resume(Dpi_kernel_task *task, uint64_t wait_id);
+  void suspend();
+  void check_ext_events();
+
+  std::priority_queue<Dpi_kernel_event> events;
+  uint64_t seq;
+  int64_t time;
+  int64_t stack_size;
+  bool failed;
+  bool quiet;
+  int trace_level;
+  std::vector<Dpi_kernel_comp *> comps;
+  std::vector<void *> models;
+  std::vector<Dpi_kernel_itf *> itfs;
+  Dpi_kernel_task *current_task;
+  void *main_context;
+  std::mutex ext_mutex;
+  std::vector<Dpi_kernel_comp *> ext_events;
+};
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __DPI_MEM_HPP__
+#define __DPI_MEM_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <json.hpp>
+
+#include "dpi/mem_shm.h"
+
+#define DPI_MEM_PAGE_BITS 12
+
+/*
+ * Sparse memory content
+ *
+ * The content is split into pages which are only allocated when they are
+ * first written. Pages which have never been written are read with the fill
+ * value, so that big memories only cost what is really used, and resetting
+ * or erasing a region just releases its pages.
+ *
+ * The initial content can also be taken from a file, in which case its pages
+ * are mapped and only read from the file when they are accessed.
+ *
+ * Accesses are not checked, the caller must check the range with
+ * check_range before accessing.
+ */
+
+class Dpi_mem
+{
+public:
+  Dpi_mem(uint64_t size, uint8_t fill=0, int page_bits=DPI_MEM_PAGE_BITS);
+  ~Dpi_mem();
+
+  uint64_t get_size() { return this->size; }
+  uint8_t get_fill() { return this->fill_value; }
+
+  // Return true if [addr, addr+size[ is inside the memory
+  inline bool check_range(uint64_t addr, uint64_t size=1)
+  {
+    return addr < this->size && size <= this->size - addr;
+  }
+
+  inline uint8_t read(uint64_t addr)
+  {
+    uint8_t *page = this->pages[addr >> this->page_bits];
+    return page ? page[addr & this->page_mask] : this->fill_value;
+  }
+
+  inline void write(uint64_t addr, uint8_t value)
+  {
+    uint8_t *page = this->pages[addr >> this->page_bits];
+    if (page == NULL)
+      page = this->page_alloc(addr >> this->page_bits);
+    page[addr & this->page_mask] = value;
+    if (this->shm)
+      this->shm_modified();
+  }
+
+  void read_block(uint64_t addr, uint8_t *data, uint64_t size);
+  void write_block(uint64_t addr, const uint8_t *data, uint64_t size);
+
+  // Set a region to the same value. Pages which are fully covered and set
+  // to the fill value are released.
+  void fill(uint64_t addr, uint64_t size, uint8_t value);
+
+  // Set back the whole memory to the fill value
+  void clear();
+
+  // Same as clear but without touching the content. Pages are just detached
+  // so that they are read with the fill value, and are only reset when they
+  // are written again, which keeps it cheap for big memories.
+  void invalidate();
+
+  // Map a binary file at the beginning of the memory. The mapping is
+  // private, the file is never modified and pages are copied when they are
+  // written. Returns -1 if the file can not be mapped.
+  int map_file(std::string path);
+
+  // Back the whole memory with a file so that the content is kept after the
+  // simulation. The file is extended with the fill value if needed.
+  // Returns 1 if the file was created, 0 if it already existed and -1 in
+  // case of error.
+  int map_persistent(std::string path);
+
+  // Move the content to a named POSIX shared memory segment so that other
+  // processes can inspect or patch it while the simulation runs, see
+  // mem_shm.h for the layout. A new segment is created with the current
+  // content, replacing the one of a previous simulation with the same name.
+  // It is not removed at the end of the simulation. Returns -1 in case of
+  // error.
+  int map_shm(std::string name);
+
+  // Call map_shm if the model has a shm_name option. Returns -1 in case of
+  // error, with an error giving the name.
+  int map_shm_from_config(js::config *config);
+
+  // Load a memory image, see Dpi_mem_image for the supported formats.
+  // Binary images are mapped with map_file, the others are parsed and
+  // written. Addresses from the other formats are relative to base and
+  // bytes falling outside the memory are ignored. Returns -1 in case of
+  // error.
+  int load_file(std::string path, std::string format="", uint64_t base=0);
+
+  // Load the file given by the preload_file option of a model, with the
+  // preload_format and preload_base options. Does nothing if there is no
+  // such option. Returns -1 in case of error, with an error giving the path.
+  int preload_from_config(js::config *config);
+
+  // Write the whole content to a binary file. Returns -1 in case of error.
+  int dump(std::string path);
+
+  // Write the CRC32 of each region of region_size bytes to a JSON file, so
+  // that the content can be compared against a golden image without
+  // dumping it. Returns -1 in case of error.
+  int dump_crc(std::string path, uint64_t region_size);
+
+  // Dump the content and its checksums as asked by the dump_file,
+  // dump_crc_file and dump_crc_region_size options of a model, usually when
+  // it stops. Returns -1 if one of them fails, with an error giving the path.
+  int dump_from_config(js::config *config);
+
+  // CRC32 (IEEE 802.3, as zlib) of a buffer, crc being the result for the
+  // previous buffers or 0
+  static uint32_t crc32(const uint8_t *data, uint64_t size, uint32_t crc=0);
+
+  // Error from the last failing call to map_file, map_persistent, map_shm,
+  // load_file, dump, dump_crc or to a *_from_config helper
+  std::string get_error() { return this->error; }
+
+private:
+  typedef enum {
+    PAGE_NONE,
+    PAGE_ALLOCATED,
+    PAGE_MAPPED,
+    PAGE_SHARED
+  } page_kind_e;
+
+  uint8_t *page_alloc(uint64_t page);
+  void page_release(uint64_t page);
+  uint64_t get_page_size(uint64_t page);
+  uint8_t *page_revalidate(uint64_t page);
+
+  // Only the simulator writes the generation, the release store orders it
+  // after the content for the readers
+  inline void shm_modified()
+  {
+    __atomic_store_n(&this->shm->generation, this->shm->generation + 1, __ATOMIC_RELEASE);
+  }
+
+  uint64_t size;
+  uint8_t fill_value;
+  int page_bits;
+  uint64_t page_mask;
+  std::vector<uint8_t *> pages;
+  std::vector<uint8_t> page_kind;
+  // Pages detached by invalidate, still owned by the memory
+  std::vector<uint8_t *> invalid_pages;
+  std::vector<std::pair<void *, size_t>> mappings;
+  bool persistent = false;
+  dpi_mem_shm_header_t *shm = NULL;
+  std::string error;
+};
+
+/*
+ * Memory image
+ *
+ * Decoded content of a preload file, as a list of contiguous segments, so
+ * that it can be parsed once and written into several memories.
+ * Supported formats are:
+ * - "bin": raw binary, loaded at address 0
+ * - "slm": one "@<addr> <byte>" line per byte, in hexadecimal
+ * - "hex": Intel HEX
+ * - "elf": PT_LOAD segments, loaded at their physical address
+ * When no format is given, it is guessed from the file content and
+ * extension. Big SLM and HEX files are parsed in parallel chunks.
+ */
+
+class Dpi_mem_image
+{
+public:
+  class Segment
+  {
+  public:
+    uint64_t addr;
+    std::vector<uint8_t> data;
+  };
+
+  int load(std::string path, std::string format="");
+
+  // Write the image into the memory. Returns the number of bytes which
+  // were outside the memory.
+  uint64_t apply(Dpi_mem *mem, uint64_t base=0);
+
+  std::string get_format() { return this->format; }
+  std::string get_error() { return this->error; }
+
+  std::vector<Segment> segments;
+
+  // Guess the format of a file from its first bytes and its extension
+  static std::string get_file_format(std::string path);
+
+private:
+  int load_slm(const char *data, size_t size);
+  int load_hex(const char *data, size_t size);
+  int load_elf(const uint8_t *data, size_t size);
+
+  std::string format;
+  std::string error;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __DPI_MEM_SHM_H__
+#define __DPI_MEM_SHM_H__
+
+#include <stdint.h>
+
+/*
+ * Layout of the POSIX shared memory segments where memory models put their
+ * content when they are given a shm_name option (see Dpi_mem::map_shm), so
+ * that external processes can inspect or patch it while the simulation runs.
+ *
+ * The segment starts with this header, and the content follows at
+ * data_offset. The magic is written last, once the header and the content are
+ * initialized.
+ *
+ * Each simulation unlinks the segment left by the previous one and creates a
+ * new one under the same name. A process which still maps the old segment
+ * keeps seeing the old content, and must open the name again to follow the
+ * new simulation (the pid tells which simulation a segment belongs to).
+ *
+ * The generation is increased each time the model modifies the content. A
+ * consistent copy can be taken by reading the generation before and after the
+ * copy, and retrying if it changed.
+ *
+ * Content patched by an external process is seen by the model at the latest
+ * from its next transaction. A read command which is in progress may have
+ * already fetched the next bytes (up to DPI_SPI_READ_BURST_SIZE for spiflash
+ * and spiram) and keeps sending their previous value.
+ */
+
+#define DPI_MEM_SHM_MAGIC   0x4d495044  /* "DPIM" */
+#define DPI_MEM_SHM_VERSION 1
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  // Offset of the content from the beginning of the segment
+  uint64_t data_offset;
+  // Size of the content in bytes
+  uint64_t size;
+  uint64_t generation;
+  // Process id of the simulator
+  uint32_t pid;
+  // Value of the content which has never been written
+  uint8_t fill_value;
+  uint8_t reserved[3];
+} dpi_mem_shm_header_t;
+
+#endif
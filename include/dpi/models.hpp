@@ -23,32 +23,248 @@
 
 #include <json.hpp>
 #include <map>
+#include <vector>
+#include <stdarg.h>
+#include <chrono>
+
+#include "dpi/binary_trace.hpp"
+
+class Dpi_mem;
 
 #ifdef USE_DPI
 #include "questa/dpiheader.h"
 #endif
 
 
+// Trace messages with a level above this one are removed at compile time.
+// Can be overridden from the command line, e.g. -DDPI_TRACE_MAX_LEVEL=2
+#ifndef DPI_TRACE_MAX_LEVEL
+#define DPI_TRACE_MAX_LEVEL 4
+#endif
+
+// Trace level of the components which have no trace_level option. Level 4
+// messages are emitted on every pin edge, so they are only kept when asked for.
+#ifndef DPI_TRACE_DEFAULT_LEVEL
+#define DPI_TRACE_DEFAULT_LEVEL 3
+#endif
+
+// Interface statistics are only collected when the model configuration
+// contains a stats_file, and can be removed at compile time with -DDPI_STATS=0
+#ifndef DPI_STATS
+#define DPI_STATS 1
+#endif
+
+
+
+// Runtime statistics of an interface, dumped to the model stats file when
+// the model is stopped
+class Dpi_itf_stats
+{
+  public:
+    // Pin edges exchanged with the testbench, in both directions
+    int64_t nb_edges = 0;
+    int64_t nb_transactions = 0;
+    int64_t nb_bytes = 0;
+    // Host time spent in the model callbacks, in ns
+    int64_t callback_time = 0;
+    std::map<int, int64_t> commands;
+};
+
+
 
 class Dpi_itf
 {
   public:
     void bind(void *handle);
+    // Used by the batched edge functions. While set, the output of the
+    // interface is stored to this location instead of being sent to the
+    // testbench, and -1 is kept if nothing is driven.
+    void batch_set(int *out) { this->batch_out = out; if (out) *out = -1; }
+
+    void stats_enable() { if (this->stats == NULL) this->stats = new Dpi_itf_stats(); }
+    Dpi_itf_stats *get_stats() { return this->stats; }
+
+    // Statistics accounting, called by the DPI layer for edges and by the
+    // models for transactions, bytes and commands
+    void stats_edges(int64_t nb_edges)
+    {
+#if DPI_STATS
+      if (this->stats) this->stats->nb_edges += nb_edges;
+#endif
+    }
+    void stats_transaction()
+    {
+#if DPI_STATS
+      if (this->stats) this->stats->nb_transactions++;
+#endif
+    }
+    void stats_bytes(int64_t nb_bytes)
+    {
+#if DPI_STATS
+      if (this->stats) this->stats->nb_bytes += nb_bytes;
+#endif
+    }
+    void stats_command(int command)
+    {
+#if DPI_STATS
+      if (this->stats) this->stats->commands[command]++;
+#endif
+    }
 
   protected:
+    // Return true if the output has been captured by the current batch
+    bool batch_push(int value) { if (this->batch_out == NULL) return false; *this->batch_out = value; return true; }
+
     void *sv_handle;
+    int *batch_out = NULL;
+    Dpi_itf_stats *stats = NULL;
 };
 
 
 
+// Account the time spent in a testbench call to the interface, from the
+// creation of this object until the end of its scope
+class Dpi_itf_stats_scope
+{
+  public:
+    Dpi_itf_stats_scope(Dpi_itf *itf)
+    {
+#if DPI_STATS
+      this->stats = itf->get_stats();
+      if (this->stats) this->start = std::chrono::steady_clock::now();
+#endif
+    }
+
+    ~Dpi_itf_stats_scope()
+    {
+#if DPI_STATS
+      if (this->stats) this->stats->callback_time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count();
+#endif
+    }
+
+  private:
+#if DPI_STATS
+    Dpi_itf_stats *stats;
+    std::chrono::steady_clock::time_point start;
+#endif
+};
+
+
+
+// Descriptor of a complete QSPI transaction, from chip select falling edge
+// to chip select rising edge, used by the transaction-level interface.
+// Each phase is skipped when its number of bits is 0.
+class Qspi_transfer
+{
+  public:
+    // Clock period in ps, used to compute the time of each phase
+    int64_t period;
+    uint64_t cmd;
+    int cmd_bits;
+    int cmd_lanes;
+    uint64_t addr;
+    int addr_bits;
+    int addr_lanes;
+    int dummy_cycles;
+    int data_lanes;
+    bool is_write;
+    // Number of data bytes, sent from data for writes, stored to data for reads
+    int size;
+    uint8_t *data;
+
+    // Number of clock cycles before the data phase
+    int64_t get_header_cycles()
+    {
+      return (this->cmd_bits + this->cmd_lanes - 1) / this->cmd_lanes
+        + (this->addr_bits + this->addr_lanes - 1) / this->addr_lanes + this->dummy_cycles;
+    }
+
+    int64_t get_duration()
+    {
+      return (this->get_header_cycles() + ((int64_t)this->size * 8 + this->data_lanes - 1) / this->data_lanes) * this->period;
+    }
+};
+
+
+
+// Set in the batched outputs when the 4 lanes are driven, the value of each
+// lane is then stored on 2 bits, starting from data_0
+#define QSPI_BATCH_QPI (1<<8)
+
+// Same when the 8 lanes are driven
+#define QSPI_BATCH_OCTAL (1<<16)
+
 class Qspi_itf : public Dpi_itf
 {
   public:
     virtual void sck_edge(int64_t timestamp, int sck, int data_0, int data_1, int data_2, int data_3, int mask) {};
     virtual void edge(int64_t timestamp, int data_0, int data_1, int data_2, int data_3, int mask) {};
     virtual void cs_edge(int64_t timestamp, int cs) {};
+    // Transaction-level access, returns -1 if the model only supports edges,
+    // in which case the testbench must fall back to the edge callbacks
+    virtual int transfer(int64_t timestamp, Qspi_transfer *transfer) { return -1; };
+    // Octal variants of the edge callbacks, the 8 lanes are packed into data,
+    // data_0 being bit 0. Models without octal support only see the first 4
+    // lanes.
+    virtual void octal_sck_edge(int64_t timestamp, int sck, int data, int mask)
+    {
+      this->sck_edge(timestamp, sck, (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, mask & 0xf);
+    }
+    virtual void octal_edge(int64_t timestamp, int data, int mask)
+    {
+      this->edge(timestamp, (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, mask & 0xf);
+    }
     void set_data(int data_0);
     void set_qpi_data(int data_0, int data_1, int data_2, int data_3, int mask);
+    void set_octal_data(int data, int mask);
+};
+
+
+
+// Descriptor of a complete HyperBus transaction, used by the
+// transaction-level interface
+class Hyper_transfer
+{
+  public:
+    // Clock period in ps
+    int64_t period;
+    // 48 bits command-address word
+    uint64_t cmd_addr;
+    // Number of data bytes, sent from data for writes, stored to data for reads
+    int size;
+    uint8_t *data;
+    // Number of latency clock cycles inserted by the memory, set by the model
+    int latency;
+
+    bool is_read() { return (this->cmd_addr >> 47) & 1; }
+
+    int64_t get_duration()
+    {
+      // 3 cycles for the command-address and 2 bytes per cycle
+      return (3 + this->latency + ((int64_t)this->size + 1) / 2) * this->period;
+    }
+};
+
+
+
+// Set in the batched outputs when the data lanes are driven, RWDS is then
+// on bit 8 and the data on bits 0 to 7, otherwise only RWDS is driven
+#define HYPER_BATCH_DATA (1<<9)
+
+// HyperBus interface. Data is transferred on both clock edges, so each call
+// to ck_edge, and each call to edge for devices without clock, is one byte
+// on the 8 data lanes. rwds is the read-write data strobe, which is the
+// byte mask during writes.
+class Hyper_itf : public Dpi_itf
+{
+  public:
+    virtual void cs_edge(int64_t timestamp, int cs) {};
+    virtual void ck_edge(int64_t timestamp, int ck, int rwds, int data, int mask) {};
+    virtual void edge(int64_t timestamp, int rwds, int data, int mask) {};
+    // Transaction-level access, returns -1 if the model only supports edges
+    virtual int transfer(int64_t timestamp, Hyper_transfer *transfer) { return -1; };
+    // Drive RWDS and the data lanes given by mask, 0 to only drive RWDS
+    void set_data(int rwds, int data, int mask);
 };
 
 
@@ -116,13 +332,60 @@ class Ctrl_itf : public Dpi_itf
 
 
 
-class Dpi_handler {
+// Handle returned by Dpi_model::trace_new. The active level is cached here so
+// that filtered messages can be dropped before they are formatted.
+class Dpi_trace
+{
+public:
+  Dpi_trace(void *handle, int level, Dpi_binary_trace *binary, int id)
+  : handle(handle), level(level), binary(binary), id(id) {}
+  void *handle;
+  int level;
+  // Not NULL if messages are dumped in binary format instead of being sent
+  // to the simulator
+  Dpi_binary_trace *binary;
+  int id;
+};
+
+
+// Time-ordered queue of delayed handlers. This is a binary heap of indexes
+// into a pool of handler slots, so that pushing and cancelling are O(log n)
+// and do not allocate once the pool is big enough.
+// Handlers with the same time are executed in the order they were pushed.
+class Dpi_scheduler
+{
 public:
-  Dpi_handler(void *arg0, void *arg1, int64_t time) : arg0(arg0), arg1(arg1), time(time) {}
-  void *arg0;
-  void *arg1;
-  int64_t time;
-  Dpi_handler *next;
+  Dpi_scheduler() : seq(0) {}
+
+  // Return an id which can be used to cancel the handler
+  int64_t push(int64_t time, void *callback, void *arg);
+  bool cancel(int64_t id);
+  bool empty() { return this->heap.size() == 0; }
+  int64_t next_time() { return this->handlers[this->heap[0]].time; }
+  // Pop the first handler if it is due at the given time
+  bool pop(int64_t time, void **callback, void **arg);
+
+private:
+  class Dpi_handler {
+  public:
+    void *callback;
+    void *arg;
+    int64_t time;
+    uint64_t seq;
+    uint32_t generation;
+    int heap_index;
+  };
+
+  bool before(int slot0, int slot1);
+  void swap(int index0, int index1);
+  void sift_up(int index);
+  void sift_down(int index);
+  void remove(int index);
+
+  std::vector<Dpi_handler> handlers;
+  std::vector<int> free_slots;
+  std::vector<int> heap;
+  uint64_t seq;
 };
 
 
@@ -130,11 +393,13 @@ class Dpi_model
 {
 public:
   Dpi_model(js::config *config, void *handle);
+  virtual ~Dpi_model();
   void *bind_itf(std::string name, void *handle);
   void create_itf(std::string name, Dpi_itf *itf);
   void create_task(void *arg1, void *arg2);
   void create_periodic_handler(int64_t period, void *arg1, void *arg2);
-  void create_delayed_handler(int64_t period, void *arg1, void *arg2);
+  int64_t create_delayed_handler(int64_t period, void *arg1, void *arg2);
+  void cancel_delayed_handler(int64_t id);
   static void callback_task_stub(void *__this);
   void callback_task();
   void wait(int64_t ns);
@@ -150,18 +415,54 @@ public:
   virtual void stop() {};
   void stop_all();
 
+  // Memory which the testbench can access through the backdoor functions
+  // (dpi_model_mem_read, ...), NULL if the model has none
+  Dpi_mem *get_backdoor_mem() { return this->backdoor_mem; }
+
 protected:
+  // Called by memory models in their constructor to give access to their
+  // content
+  void set_backdoor_mem(Dpi_mem *mem) { this->backdoor_mem = mem; }
+
   void *trace_new(const char *name);
-  void trace_msg(void *trace, int level, const char *format, ...);
+  void trace_set_level(void *trace, int level);
+
+  inline bool trace_active(void *trace, int level)
+  {
+    return level <= DPI_TRACE_MAX_LEVEL && level <= ((Dpi_trace *)trace)->level;
+  }
+
+  // Arguments are only formatted if the message passes the level check
+  template<typename... Args>
+  inline void trace_msg(void *trace, int level, const char *format, Args... args)
+  {
+    if (this->trace_active(trace, level))
+    {
+      Dpi_trace *dpi_trace = (Dpi_trace *)trace;
+      if (dpi_trace->binary)
+        dpi_trace->binary->dump(this->get_time(), dpi_trace->id, level, format, args...);
+      else
+        this->trace_msg_fmt(trace, level, format, args...);
+    }
+  }
+
+  void trace_msg_fmt(void *trace, int level, const char *format, ...);
   void print(const char *format, ...);
   void fatal(const char *format, ...);
+  int64_t get_time();
   js::config *get_config();
 
 private:
+  void stats_dump();
+
   js::config *config;
   std::map<std::string, Dpi_itf *> itfs;
+  std::string stats_file;
   void *handle;
-  Dpi_handler *first_handler;
+  Dpi_scheduler scheduler;
+  int trace_level;
+  Dpi_binary_trace *binary_trace;
+  Dpi_mem *backdoor_mem = NULL;
 };
 
 typedef enum
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __DPI_SPI_SHIFTER_HPP__
+#define __DPI_SPI_SHIFTER_HPP__
+
+#include <stdint.h>
+
+/*
+ * SPI phase shifter
+ *
+ * Serializes or deserializes one phase of an SPI frame (command, address,
+ * data, ...) on 1, 2, 4 or 8 lanes, most significant bits first. The lanes
+ * of one clock edge are packed into an int, data_0 being bit 0.
+ *
+ * The phase width is decided once with start() when the phase begins, so
+ * that each edge only costs a shift and a compare. When a phase completes,
+ * the next one of the same size is started automatically, which is what is
+ * needed for the data phase of a memory.
+ */
+
+class Dpi_spi_shifter
+{
+public:
+  // Pack the lanes sampled on an edge
+  static inline int pack(int data_0, int data_1, int data_2, int data_3)
+  {
+    return data_0 | (data_1 << 1) | (data_2 << 2) | (data_3 << 3);
+  }
+
+  // Start a phase of nb_bits bits on nb_lanes lanes
+  inline void start(int nb_bits, int nb_lanes)
+  {
+    this->nb_bits = nb_bits;
+    this->nb_lanes = nb_lanes;
+    this->lanes_mask = (1 << nb_lanes) - 1;
+    this->count = 0;
+    this->pending = 0;
+  }
+
+  // Shift in the lanes of one edge. Returns true when the phase is complete,
+  // in which case the received value can be read with get().
+  inline bool push(int lanes)
+  {
+    this->pending = (this->pending << this->nb_lanes) | (lanes & this->lanes_mask);
+    this->count += this->nb_lanes;
+    if (this->count < this->nb_bits)
+      return false;
+
+    this->value = this->pending;
+    this->pending = 0;
+    this->count = 0;
+    return true;
+  }
+
+  inline uint64_t get() { return this->value; }
+
+  // Returns true when the next pop() starts a new value, i.e. when the model
+  // must provide it with load()
+  inline bool need_load() { return this->count == 0; }
+
+  inline void load(uint64_t value) { this->value = value; }
+
+  // Returns the lanes to be driven for the next edge
+  inline int pop()
+  {
+    this->count += this->nb_lanes;
+    int lanes = (this->value >> (this->nb_bits - this->count)) & this->lanes_mask;
+    if (this->count >= this->nb_bits)
+      this->count = 0;
+    return lanes;
+  }
+
+  // Number of bits already shifted for the current value
+  inline int get_count() { return this->count; }
+
+  inline int get_nb_lanes() { return this->nb_lanes; }
+
+private:
+  uint64_t pending = 0;
+  uint64_t value = 0;
+  int nb_bits = 8;
+  int nb_lanes = 1;
+  int lanes_mask = 1;
+  int count = 0;
+};
+
+#define DPI_SPI_READ_BURST_SIZE 64
+
+/*
+ * SPI read burst
+ *
+ * Lanes to be driven for the next bytes of a memory read. The model reads
+ * a block of bytes into the buffer and the lanes of all their edges are
+ * computed at once with load(), so that each edge of a long read, like
+ * the ones of an execute-in-place fetch, only pops a precomputed value.
+ */
+
+class Dpi_spi_read_burst
+{
+public:
+  // Buffer where the model must put the bytes before calling load()
+  inline uint8_t *get_buffer() { return this->data; }
+
+  // Compute the edges of the first size bytes of the buffer
+  inline void load(int size, int nb_lanes)
+  {
+    this->edges_per_byte = 8 / nb_lanes;
+    this->nb_edges = size * this->edges_per_byte;
+    this->index = 0;
+
+    if (nb_lanes == 8)
+    {
+      for (int i=0; i<size; i++)
+        this->edges[i] = this->data[i];
+    }
+    else if (nb_lanes == 4)
+    {
+      for (int i=0; i<size; i++)
+      {
+        this->edges[i*2 + 0] = this->data[i] >> 4;
+        this->edges[i*2 + 1] = this->data[i] & 0xf;
+      }
+    }
+    else if (nb_lanes == 1)
+    {
+      for (int i=0; i<size; i++)
+      {
+        for (int j=0; j<8; j++)
+          this->edges[i*8 + j] = (this->data[i] >> (7 - j)) & 1;
+      }
+    }
+    else
+    {
+      int mask = (1 << nb_lanes) - 1;
+      for (int i=0; i<this->nb_edges; i++)
+      {
+        int byte = i / this->edges_per_byte;
+        int shift = 8 - nb_lanes * (i % this->edges_per_byte + 1);
+        this->edges[i] = (this->data[byte] >> shift) & mask;
+      }
+    }
+  }
+
+  inline bool empty() { return this->index == this->nb_edges; }
+
+  // Returns the lanes to be driven for the next edge
+  inline int pop() { return this->edges[this->index++]; }
+
+  // Number of bytes whose first edge has already been popped
+  inline int get_started_bytes()
+  {
+    return (this->index + this->edges_per_byte - 1) / this->edges_per_byte;
+  }
+
+  // Drop the remaining edges
+  inline void reset() { this->index = this->nb_edges = 0; }
+
+private:
+  uint8_t data[DPI_SPI_READ_BURST_SIZE];
+  uint8_t edges[DPI_SPI_READ_BURST_SIZE * 8];
+  int edges_per_byte = 8;
+  int nb_edges = 0;
+  int index = 0;
+};
+
+#endif
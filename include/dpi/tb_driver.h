@@ -79,15 +79,48 @@ void dpi_driver_get_comp_itf_info(void *comp_handle, int index, int itf_index,
   const char **itf_name, const char **itf_type, int *itf_id, int *itf_sub_id);
 
 
-// Load the DPI model for the specified component JSON descriptor
+// Load the DPI model for the specified component JSON descriptor.
+// Besides its own options, the component configuration can contain:
+//   trace_level:  highest level of the trace messages sent to the simulator,
+//                 from 1 to 4 (default: 3, level 4 traces every pin edge)
+//   binary_trace: {"path": ..., "nb_records": ...}, dump traces into a
+//                 binary ring buffer decoded offline with dpi_trace_decode
+//   stats_file:   file where the interface statistics are dumped at stop
 void *dpi_model_load(void *config, void *handle);
 
 
+// Load the DPI models for the specified component JSON descriptors. Instances
+// of the same model are created together so that they can share state.
+// configs, handles and models are arrays of nb_models pointers.
+// Return 0 if all models were successfully loaded. Otherwise the models
+// already created are freed and all the entries of models are NULL.
+int dpi_model_load_many(int nb_models, void *configs, void *handles, void *models);
+
+
 int dpi_model_start(void *handle);
 
 int dpi_model_stop(void *handle);
 
 
+/* MEMORY BACKDOOR
+ * Access the content of a memory model (spiflash, spiram, ...) in zero
+ * simulated time, e.g. to preload a test binary or to check the results
+ * without going through the chip interfaces. handle is the one returned by
+ * dpi_model_load and data is an array of bytes. Writes are seen by the
+ * model at the latest from its next transaction, a read command which is in
+ * progress may keep sending bytes it has already fetched.
+ * Return -1 if the model has no memory or if the access is out of range. */
+
+int dpi_model_mem_write(void *handle, uint64_t addr, void *data, int size);
+
+int dpi_model_mem_read(void *handle, uint64_t addr, void *data, int size);
+
+// Load a memory image (see Dpi_mem::load_file for the formats, "" to guess
+// it). base is the address of the memory in the image address space, like
+// the preload_base option.
+int dpi_model_mem_load_file(void *handle, const char *path, const char *format, uint64_t base);
+
+
 int dpi_start_task(int id);
 
 void dpi_exec_periodic_handler(int id);
@@ -111,6 +144,8 @@ void *dpi_i2s_bind(void *comp_handle, const char *name, int handle);
 
 void *dpi_i2c_bind(void *comp_handle, const char *name, int handle);
 
+void *dpi_hyper_bind(void *comp_handle, const char *name, int handle);
+
 void dpi_uart_edge(void *handle, int64_t timestamp, int data);
 
 void dpi_i2c_edge(void *handle, int64_t timestamp, int scl, int sda);
@@ -119,11 +154,74 @@ void dpi_i2s_edge(void *handle, int64_t timestamp, int sck, int ws, int sd);
 
 int dpi_qspim_cs_edge(void *handle, int64_t timestamp, int active);
 
+int dpi_qspim_sck_edge(void *handle, int64_t timestamp, uint8_t sck, uint8_t data_0, uint8_t data_1, uint8_t data_2, uint8_t data_3, int mask);
+
 void dpi_qspim_edge(void *handle, int64_t timestamp, int data_0, int data_1, int data_2, int data_3, int mask);
 
+// Octal variants, data_0 to data_7 are packed into data, data_0 on bit 0.
+// In double transfer rate phases, models sample and drive data on both sck
+// edges, and each call to dpi_qspim_octal_edge is then half a clock cycle.
+int dpi_qspim_octal_sck_edge(void *handle, int64_t timestamp, int sck, int data, int mask);
+
+void dpi_qspim_octal_edge(void *handle, int64_t timestamp, int data, int mask);
+
+// Execute a whole transaction (command, address, dummy cycles and data) in a
+// single call. Returns -1 if the model does not support transactions.
+int dpi_qspim_transfer(void *handle, int64_t timestamp, int64_t period, uint64_t cmd, int cmd_bits, int cmd_lanes,
+  uint64_t addr, int addr_bits, int addr_lanes, int dummy_cycles, int data_lanes, int is_write, int size, void *data);
+
+// HyperBus, each call to dpi_hyper_ck_edge or dpi_hyper_edge is one byte
+// on the 8 data lanes, as data is transferred on both clock edges
+int dpi_hyper_cs_edge(void *handle, int64_t timestamp, int cs);
+
+int dpi_hyper_ck_edge(void *handle, int64_t timestamp, int ck, int rwds, int data, int mask);
+
+void dpi_hyper_edge(void *handle, int64_t timestamp, int rwds, int data, int mask);
+
+// Execute a whole HyperBus transaction from its 48 bits command-address word.
+// Returns the number of latency clock cycles inserted by the memory before
+// the data, or -1 if the model does not support transactions.
+int dpi_hyper_transfer(void *handle, int64_t timestamp, int64_t period, uint64_t cmd_addr, int size, void *data);
+
 void dpi_gpio_edge(void *handle, int64_t timestamp, int data);
 
 
+/* BATCHED EDGES
+ * Apply nb_edges samples in one call, sample i at timestamps[i]. Buffers are
+ * passed as open arrays from SystemVerilog, so they are untyped here:
+ * timestamps is an array of int64_t, pins of uint8_t and out of int.
+ * The pin values of each sample are packed in one byte:
+ *   qspim sck:  data_0 to data_3 on bits 0 to 3, sck on bit 4
+ *   qspim edge: data_0 to data_3 on bits 0 to 3
+ *   qspim octal sck: data_0 to data_7 on bits 0 to 7, sck on bit 8, in an
+ *               array of uint16_t
+ *   hyper ck:   data on bits 0 to 7, rwds on bit 8, ck on bit 9, in an
+ *               array of uint16_t
+ *   uart:       data on bit 0
+ *   i2c:        scl on bit 0, sda on bit 1
+ *   i2s:        sck on bit 0, ws on bit 1, sd on bit 2
+ * If out is not NULL, out[i] receives the value driven by the model while
+ * handling sample i, or -1 if nothing was driven, instead of going through
+ * the output functions (dpi_qspim_set_data, ...). Values are encoded like the
+ * arguments of the output function, with 2 bits per signal when there are
+ * several (see QSPI_BATCH_QPI and QSPI_BATCH_OCTAL for qspim).
+ * Return the number of processed samples. */
+
+int dpi_qspim_sck_edges(void *handle, void *timestamps, void *pins, int nb_edges, int mask, void *out);
+
+int dpi_qspim_edges(void *handle, void *timestamps, void *pins, int nb_edges, int mask, void *out);
+
+int dpi_qspim_octal_sck_edges(void *handle, void *timestamps, void *pins, int nb_edges, int mask, void *out);
+
+int dpi_hyper_ck_edges(void *handle, void *timestamps, void *pins, int nb_edges, int mask, void *out);
+
+int dpi_uart_edges(void *handle, void *timestamps, void *pins, int nb_edges, void *out);
+
+int dpi_i2c_edges(void *handle, void *timestamps, void *pins, int nb_edges, void *out);
+
+int dpi_i2s_edges(void *handle, void *timestamps, void *pins, int nb_edges, void *out);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,803 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+// Micro-benchmarks of the models.
+// Each model is loaded on top of the standalone kernel, with traces disabled,
+// and receives synthetic pin traffic through its interfaces, one DPI call per
+// edge posted to the kernel like from the testbench, so that the timers of the
+// models are executed too. The host time per edge and the throughput are
+// reported for each command type. Memories are preloaded with a known pattern
+// which the data read back is checked against.
+//
+// Usage: dpi_models_bench [-p <model dir>] [-n <edges per case>] [case name filter...]
+
+#include "dpi/models.hpp"
+#include "dpi/kernel.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+
+#ifndef BENCH_MODEL_PATH
+#define BENCH_MODEL_PATH "."
+#endif
+
+// Half period of the generated clocks, 100MHz
+#define BENCH_HALF_PERIOD 5000
+
+static Dpi_kernel *kernel;
+static std::string model_path = BENCH_MODEL_PATH;
+static int64_t nb_edges = 0;
+static bool data_error = false;
+// Files created for the models, removed when the bench exits as some models
+// open them again during the simulation
+static std::vector<std::string> tmp_paths;
+
+
+// Content preloaded into the memories
+static inline uint8_t bench_pattern(uint64_t addr)
+{
+  return (uint8_t)(addr * 7 + (addr >> 8) + 1);
+}
+
+static bool check_data(std::string name, uint64_t addr, const uint8_t *data, int size)
+{
+  for (int i=0; i<size; i++)
+  {
+    if (data[i] != bench_pattern(addr + i))
+    {
+      if (!data_error)
+        fprintf(stderr, "%s: wrong data read (addr: 0x%lx, value: 0x%x, expected: 0x%x)\n",
+          name.c_str(), (unsigned long)(addr + i), data[i], bench_pattern(addr + i));
+      data_error = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void remove_tmp_files()
+{
+  for (auto &path: tmp_paths)
+    unlink(path.c_str());
+}
+
+// Binary file with the pattern
+static std::string create_preload(uint64_t size)
+{
+  char path[] = "/tmp/dpi_bench_XXXXXX.bin";
+  int fd = mkstemps(path, 4);
+  if (fd == -1)
+    return "";
+
+  std::vector<uint8_t> content(size);
+  for (uint64_t i=0; i<size; i++)
+    content[i] = bench_pattern(i);
+
+  tmp_paths.push_back(path);
+  bool ok = write(fd, content.data(), size) == (ssize_t)size;
+  close(fd);
+  return ok ? path : "";
+}
+
+
+// Stimuli are executed from the kernel after the given delay, like from a
+// testbench, so that the timers and delayed handlers of the models fire in
+// between
+static void post(int64_t delay, std::function<void()> callback)
+{
+  kernel->post(delay, callback);
+  kernel->run(delay);
+}
+
+
+class Bench_itf : public Dpi_kernel_itf
+{
+public:
+  // Tristate (3) is driven when CS is released
+  void qspim_set_data(int data) { this->nb_outputs++; if (data <= 1) this->samples.push_back(data); }
+  void qspim_set_qpi_data(int data_0, int data_1, int data_2, int data_3, int mask)
+  {
+    this->nb_outputs++;
+    this->samples.push_back(data_0 | (data_1 << 1) | (data_2 << 2) | (data_3 << 3));
+  }
+  void hyper_set_data(int rwds, int data, int mask) { this->nb_outputs++; if (mask == 0xff) this->samples.push_back(data); }
+  void gpio_set_data(int data) { this->nb_outputs++; }
+  void i2c_rx_edge(int sda) { this->nb_outputs++; }
+  void i2s_rx_edge(int sck, int ws, int sd) { this->nb_outputs++; }
+
+  // Rebuild size bytes from the first data samples, each of them giving the
+  // next bits, MSB first, and drop all the samples
+  std::vector<uint8_t> get_bytes(int size, int bits)
+  {
+    std::vector<uint8_t> result(size, 0);
+    int nb_samples = size * 8 / bits;
+    if ((int)this->samples.size() < nb_samples)
+      return std::vector<uint8_t>();
+
+    for (int i=0; i<nb_samples; i++)
+    {
+      int bit = i * bits;
+      result[bit / 8] |= this->samples[i] << (8 - bits - bit % 8);
+    }
+    this->samples.clear();
+    return result;
+  }
+
+  int64_t nb_outputs = 0;
+  std::vector<int> samples;
+};
+
+static bool check_itf_data(std::string name, Bench_itf *itf, uint64_t addr, int size, int bits)
+{
+  std::vector<uint8_t> data = itf->get_bytes(size, bits);
+  if ((int)data.size() != size)
+  {
+    if (!data_error)
+      fprintf(stderr, "%s: missing data (expected: %d bytes)\n", name.c_str(), size);
+    data_error = true;
+    return false;
+  }
+  return check_data(name, addr, data.data(), size);
+}
+
+
+static void *load_model(std::string module, std::string config_str)
+{
+  char path[] = "/tmp/dpi_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1)
+    return NULL;
+
+  std::string content = "{\"name\": \"" + module + "\", \"module\": \"" + model_path + "/" + module + ".so\", \"trace_level\": 0" + config_str + "}";
+  if (write(fd, content.c_str(), content.size()) != (ssize_t)content.size())
+    return NULL;
+  close(fd);
+
+  js::config *config = js::import_config_from_file(path);
+  unlink(path);
+  if (config == NULL)
+    return NULL;
+
+  return kernel->load_model(config);
+}
+
+
+
+/*
+ * Pin drivers
+ */
+
+class Qspi_driver
+{
+public:
+  Qspi_driver(void *itf) : itf(itf) {}
+
+  void cs(int value)
+  {
+    void *itf = this->itf;
+    post(BENCH_HALF_PERIOD, [=]() { dpi_qspim_cs_edge(itf, kernel->get_time(), value); });
+    nb_edges++;
+  }
+
+  void clock(int data)
+  {
+    void *itf = this->itf;
+    post(BENCH_HALF_PERIOD, [=]() {
+      dpi_qspim_sck_edge(itf, kernel->get_time(), 1, (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, 0xf);
+    });
+    post(BENCH_HALF_PERIOD, [=]() {
+      dpi_qspim_sck_edge(itf, kernel->get_time(), 0, (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, 0xf);
+    });
+    nb_edges += 2;
+  }
+
+  // Full edge, for models using the edge callback
+  void edge(int data)
+  {
+    void *itf = this->itf;
+    post(2*BENCH_HALF_PERIOD, [=]() {
+      dpi_qspim_edge(itf, kernel->get_time(), (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, 0xf);
+    });
+    nb_edges++;
+  }
+
+  void send(uint64_t value, int bits, int lanes)
+  {
+    for (int i=bits-lanes; i>=0; i-=lanes)
+    {
+      this->clock((value >> i) & ((1 << lanes) - 1));
+    }
+  }
+
+  void send_edges(uint64_t value, int bits)
+  {
+    for (int i=bits-1; i>=0; i--)
+    {
+      this->edge((value >> i) & 1);
+    }
+  }
+
+  void wait(int cycles)
+  {
+    for (int i=0; i<cycles; i++)
+    {
+      this->clock(0);
+    }
+  }
+
+private:
+  void *itf;
+};
+
+
+class Hyper_driver
+{
+public:
+  Hyper_driver(void *itf) : itf(itf) {}
+
+  void cs(int value)
+  {
+    void *itf = this->itf;
+    post(BENCH_HALF_PERIOD, [=]() { dpi_hyper_cs_edge(itf, kernel->get_time(), value); });
+    nb_edges++;
+  }
+
+  // One byte, on the next clock edge
+  void beat(int data, int mask=0xff)
+  {
+    void *itf = this->itf;
+    int ck = this->ck ^= 1;
+    post(BENCH_HALF_PERIOD, [=]() { dpi_hyper_ck_edge(itf, kernel->get_time(), ck, 0, data, mask); });
+    nb_edges++;
+  }
+
+  void send_cmd_addr(uint64_t value)
+  {
+    for (int i=40; i>=0; i-=8)
+    {
+      this->beat((value >> i) & 0xff);
+    }
+  }
+
+  void wait(int cycles)
+  {
+    for (int i=0; i<cycles*2; i++)
+    {
+      this->beat(0, 0);
+    }
+  }
+
+private:
+  void *itf;
+  int ck = 0;
+};
+
+
+class I2c_driver
+{
+public:
+  I2c_driver(void *itf) : itf(itf) {}
+
+  void edge(int scl, int sda)
+  {
+    void *itf = this->itf;
+    post(BENCH_HALF_PERIOD, [=]() { dpi_i2c_edge(itf, kernel->get_time(), scl, sda); });
+    nb_edges++;
+  }
+
+  void start()
+  {
+    this->edge(1, 1);
+    this->edge(1, 0);
+    this->edge(0, 0);
+  }
+
+  void stop()
+  {
+    this->edge(0, 0);
+    this->edge(1, 0);
+    this->edge(1, 1);
+  }
+
+  void send_byte(uint8_t byte)
+  {
+    for (int i=7; i>=0; i--)
+    {
+      this->edge(0, (byte >> i) & 1);
+      this->edge(1, (byte >> i) & 1);
+    }
+    this->edge(0, 0);
+    this->edge(0, 1);
+    // Acknowledge cycle
+    this->edge(1, 1);
+    this->edge(0, 1);
+  }
+
+private:
+  void *itf;
+};
+
+
+
+/*
+ * Benchmark cases
+ * Each case executes one iteration of its command and returns the number of
+ * payload bytes which were transferred.
+ */
+
+class Bench_case
+{
+public:
+  Bench_case(std::string model, std::string command, std::function<int()> iter)
+  : model(model), command(command), iter(iter) {}
+
+  std::string model;
+  std::string command;
+  std::function<int()> iter;
+};
+
+static std::vector<Bench_case> cases;
+
+static void *get_model(std::string module, std::string config)
+{
+  static std::map<std::string, void *> models;
+  if (models.find(module) == models.end())
+    models[module] = load_model(module, config);
+  return models[module];
+}
+
+static void *bind(void *model, std::string name, Bench_itf **bench_itf=NULL)
+{
+  if (model == NULL)
+    return NULL;
+  Bench_itf *itf = new Bench_itf();
+  if (bench_itf)
+    *bench_itf = itf;
+  return kernel->bind(model, name, itf);
+}
+
+static void declare_spiflash()
+{
+  const int mem_size = 1 << 24;
+  std::string preload = create_preload(1 << 16);
+  Bench_itf *bench_itf;
+  void *model = get_model("spiflash", ", \"mem_size\": " + std::to_string(mem_size) + ", \"preload_file\": \"" + preload + "\"");
+  void *itf = bind(model, "input", &bench_itf);
+  if (itf == NULL)
+    return;
+
+  static Qspi_driver qspi(itf);
+  // Programmed pages are kept away from the preloaded content which is read
+  static uint32_t write_addr = mem_size / 2;
+
+  cases.push_back(Bench_case("spiflash", "read (0x03)", [=]() {
+    bench_itf->samples.clear();
+    qspi.cs(0);
+    qspi.send(0x03, 8, 1);
+    qspi.send(0, 24, 1);
+    qspi.wait(256 * 8);
+    qspi.cs(1);
+    check_itf_data("spiflash read", bench_itf, 0, 256, 1);
+    return 256;
+  }));
+
+  cases.push_back(Bench_case("spiflash", "quad read (0xEB)", [=]() {
+    bench_itf->samples.clear();
+    qspi.cs(0);
+    qspi.send(0xEB, 8, 1);
+    qspi.send(0, 24, 4);
+    qspi.wait(3);
+    qspi.wait(4096 * 2);
+    qspi.cs(1);
+    check_itf_data("spiflash quad read", bench_itf, 0, 4096, 4);
+    return 4096;
+  }));
+
+  cases.push_back(Bench_case("spiflash", "read batched", [=]() {
+    // Same traffic as the read, sent as one array of edges
+    static std::vector<int64_t> timestamps;
+    static std::vector<uint8_t> pins;
+    static std::vector<int> out;
+    if (pins.size() == 0)
+    {
+      for (int i=31; i>=0; i--)
+      {
+        int bit = i >= 24 ? (0x03 >> (i - 24)) & 1 : 0;
+        pins.push_back((1 << 4) | bit);
+        pins.push_back(bit);
+      }
+      for (int i=0; i<256*8; i++)
+      {
+        pins.push_back(1 << 4);
+        pins.push_back(0);
+      }
+      timestamps.resize(pins.size());
+      out.resize(pins.size());
+    }
+
+    qspi.cs(0);
+    post(BENCH_HALF_PERIOD, [=]() {
+      for (unsigned int i=0; i<pins.size(); i++)
+        timestamps[i] = kernel->get_time() + i * BENCH_HALF_PERIOD;
+      dpi_qspim_sck_edges(itf, timestamps.data(), pins.data(), pins.size(), 0xf, out.data());
+    });
+    kernel->run((pins.size() - 1) * BENCH_HALF_PERIOD);
+    qspi.cs(1);
+    nb_edges += pins.size();
+
+    uint8_t data[256] = { 0 };
+    int bit = 0;
+    for (unsigned int i=0; i<pins.size() && bit < 256*8; i++)
+    {
+      if (out[i] == 0 || out[i] == 1)
+      {
+        data[bit / 8] |= out[i] << (7 - bit % 8);
+        bit++;
+      }
+    }
+    check_data("spiflash read batched", 0, data, 256);
+    return 256;
+  }));
+
+  cases.push_back(Bench_case("spiflash", "quad read transfer", [=]() {
+    static uint8_t buffer[4096];
+    // Same traffic as the quad read, edges are counted as if they were sent
+    // one by one
+    int64_t cycles = 8 + 24/4 + 3 + 4096 * 2;
+    post(BENCH_HALF_PERIOD, [=]() {
+      dpi_qspim_transfer(itf, kernel->get_time(), 2*BENCH_HALF_PERIOD, 0xEB, 8, 1, 0, 24, 4, 3, 4, 0, 4096, buffer);
+    });
+    kernel->run(cycles * 2 * BENCH_HALF_PERIOD);
+    nb_edges += cycles * 2 + 2;
+    check_data("spiflash quad read transfer", 0, buffer, 4096);
+    return 4096;
+  }));
+
+  cases.push_back(Bench_case("spiflash", "page program (0x02)", [=]() {
+    qspi.cs(0);
+    qspi.send(0x06, 8, 1);
+    qspi.cs(1);
+    qspi.cs(0);
+    qspi.send(0x02, 8, 1);
+    qspi.send(write_addr, 24, 1);
+    for (int i=0; i<256; i++)
+      qspi.send(0xA5, 8, 1);
+    qspi.cs(1);
+    write_addr = write_addr + 256 < (uint32_t)mem_size ? write_addr + 256 : mem_size / 2;
+    // Let the program operation complete
+    kernel->run(30000000000);
+    return 256;
+  }));
+}
+
+static void declare_spiram()
+{
+  std::string preload = create_preload(1 << 16);
+  Bench_itf *bench_itf;
+  void *model = get_model("spiram", ", \"mem_size\": 8388608, \"cross_page_size\": 0, \"preload_file\": \"" + preload + "\"");
+  void *itf = bind(model, "input", &bench_itf);
+  if (itf == NULL)
+    return;
+
+  static Qspi_driver qspi(itf);
+
+  // Transfers are kept short so that CS is released before the refresh
+  // deadline. Writes go outside the preloaded content which is read.
+
+  cases.push_back(Bench_case("spiram", "write (0x02)", [=]() {
+    qspi.cs(0);
+    qspi.send(0x02, 8, 1);
+    qspi.send(0x100000, 24, 1);
+    for (int i=0; i<64; i++)
+      qspi.send(0x5A, 8, 1);
+    qspi.cs(1);
+    return 64;
+  }));
+
+  cases.push_back(Bench_case("spiram", "read (0x03)", [=]() {
+    bench_itf->samples.clear();
+    qspi.cs(0);
+    qspi.send(0x03, 8, 1);
+    qspi.send(0x100, 24, 1);
+    qspi.wait(64 * 8);
+    qspi.cs(1);
+    check_itf_data("spiram read", bench_itf, 0x100, 64, 1);
+    return 64;
+  }));
+
+  cases.push_back(Bench_case("spiram", "quad read (0xEB)", [=]() {
+    bench_itf->samples.clear();
+    qspi.cs(0);
+    qspi.send(0xEB, 8, 1);
+    qspi.send(0x100, 24, 1);
+    qspi.wait(6);
+    qspi.wait(256 * 2);
+    qspi.cs(1);
+    check_itf_data("spiram quad read", bench_itf, 0x100, 256, 4);
+    return 256;
+  }));
+}
+
+static void declare_hyperram()
+{
+  std::string preload = create_preload(1 << 16);
+  Bench_itf *bench_itf;
+  void *model = get_model("hyperram", ", \"mem_size\": 8388608, \"preload_file\": \"" + preload + "\"");
+  void *itf = bind(model, "input", &bench_itf);
+  if (itf == NULL)
+    return;
+
+  static Hyper_driver hyper(itf);
+
+  // Linear burst read at 0x100, with the default fixed latency of 2x6 cycles.
+  // Bursts are kept under the 4us CS limit. Writes go to 0x100000, outside
+  // the preloaded content.
+  const uint64_t read_cmd = (1ULL << 47) | (1ULL << 45) | (uint64_t)(0x100 >> 4) << 16;
+  const uint64_t write_cmd = (1ULL << 45) | (uint64_t)(0x100000 >> 4) << 16;
+
+  cases.push_back(Bench_case("hyperram", "linear read", [=]() {
+    bench_itf->samples.clear();
+    hyper.cs(0);
+    hyper.send_cmd_addr(read_cmd);
+    hyper.wait(12);
+    hyper.wait(128);
+    hyper.cs(1);
+    check_itf_data("hyperram linear read", bench_itf, 0x100, 256, 8);
+    return 256;
+  }));
+
+  cases.push_back(Bench_case("hyperram", "linear write", [=]() {
+    hyper.cs(0);
+    hyper.send_cmd_addr(write_cmd);
+    hyper.wait(12);
+    for (int i=0; i<256; i++)
+      hyper.beat(0x5A);
+    hyper.cs(1);
+    return 256;
+  }));
+
+  cases.push_back(Bench_case("hyperram", "linear read transfer", [=]() {
+    static uint8_t buffer[256];
+    // Same traffic as the linear read, edges are counted as if they were
+    // sent one by one
+    static int latency;
+    post(BENCH_HALF_PERIOD, [=]() {
+      latency = dpi_hyper_transfer(itf, kernel->get_time(), 2*BENCH_HALF_PERIOD, read_cmd, 256, buffer);
+    });
+    int64_t cycles = 3 + latency + 128;
+    kernel->run(cycles * 2 * BENCH_HALF_PERIOD);
+    nb_edges += cycles * 2 + 2;
+    check_data("hyperram linear read transfer", 0x100, buffer, 256);
+    return 256;
+  }));
+}
+
+static void declare_spim_verif()
+{
+  void *model = get_model("spim_tb", ", \"mem_size\": 1048576");
+  void *itf = bind(model, "input");
+  if (itf == NULL)
+    return;
+
+  static Qspi_driver qspi(itf);
+
+  cases.push_back(Bench_case("spim_tb", "write", [=]() {
+    int size = 1024;
+    qspi.cs(0);
+    qspi.send((1ULL << 56) | ((uint64_t)(size * 8) << 32) | 0x1000, 64, 1);
+    for (int i=0; i<size; i++)
+      qspi.send(0x3C, 8, 1);
+    qspi.cs(1);
+    return size;
+  }));
+
+  cases.push_back(Bench_case("spim_tb", "read", [=]() {
+    int size = 1024;
+    qspi.cs(0);
+    qspi.send((2ULL << 56) | ((uint64_t)(size * 8) << 32) | 0x1000, 64, 1);
+    qspi.cs(1);
+    qspi.cs(0);
+    qspi.wait(size * 8);
+    qspi.cs(1);
+    return size;
+  }));
+}
+
+static void declare_nina()
+{
+  void *model = get_model("nina_w10", "");
+  void *itf = bind(model, "input");
+  bind(model, "gpio_ready");
+  if (itf == NULL)
+    return;
+
+  static Qspi_driver qspi(itf);
+
+  cases.push_back(Bench_case("nina_w10", "receive", [=]() {
+    qspi.cs(0);
+    for (int i=0; i<2048; i++)
+      qspi.send_edges(0, 8);
+    qspi.cs(1);
+    return 2048;
+  }));
+}
+
+static void declare_ili9341()
+{
+  void *model = get_model("lcd_ili9341", "");
+  void *itf = bind(model, "input");
+  void *gpio = bind(model, "gpio");
+  if (itf == NULL || gpio == NULL)
+    return;
+
+  static Qspi_driver qspi(itf);
+
+  cases.push_back(Bench_case("lcd_ili9341", "memory write (0x2C)", [=]() {
+    qspi.cs(0);
+    post(0, [=]() { dpi_gpio_edge(gpio, kernel->get_time(), 0); });
+    qspi.send_edges(0x2C, 8);
+    post(0, [=]() { dpi_gpio_edge(gpio, kernel->get_time(), 1); });
+    for (int i=0; i<1024; i++)
+      qspi.send_edges(0xF800, 16);
+    qspi.cs(1);
+    return 2048;
+  }));
+}
+
+static void declare_eeprom()
+{
+  void *model = get_model("eeprom", "");
+  void *itf = bind(model, "i2c");
+  if (itf == NULL)
+    return;
+
+  static I2c_driver i2c(itf);
+
+  cases.push_back(Bench_case("eeprom", "write", [=]() {
+    i2c.start();
+    i2c.send_byte(0xA0);
+    i2c.send_byte(0x00);
+    i2c.send_byte(0x00);
+    for (int i=0; i<64; i++)
+      i2c.send_byte(i);
+    i2c.stop();
+    return 64;
+  }));
+}
+
+static void declare_microphone()
+{
+  char stim_path[] = "/tmp/dpi_bench_XXXXXX.hex";
+  int fd = mkstemps(stim_path, 4);
+  if (fd == -1)
+    return;
+  tmp_paths.push_back(stim_path);
+  for (int i=0; i<1024; i++)
+  {
+    char line[16];
+    int size = snprintf(line, sizeof(line), "%4.4x\n", (i * 97) & 0xffff);
+    if (write(fd, line, size) != size)
+    {
+      close(fd);
+      return;
+    }
+  }
+  close(fd);
+
+  void *model = get_model("i2s_microphone", std::string(", \"width\": 16, \"pdm\": false, \"ddr\": false, \"dual\": false")
+    + ", \"frequency\": 0, \"chain_size\": 1, \"stim_left\": \"" + stim_path + "\", \"stim_right\": \"\"");
+  void *itf = bind(model, "i2s");
+  if (itf == NULL)
+    return;
+
+  cases.push_back(Bench_case("i2s_microphone", "mono 16 bits", [=]() {
+    for (int i=0; i<32; i++)
+    {
+      int ws = i >= 16;
+      post(BENCH_HALF_PERIOD, [=]() { dpi_i2s_edge(itf, kernel->get_time(), 1, ws, 0); });
+      post(BENCH_HALF_PERIOD, [=]() { dpi_i2s_edge(itf, kernel->get_time(), 0, ws, 0); });
+    }
+    nb_edges += 64;
+    return 2;
+  }));
+}
+
+
+int main(int argc, char *argv[])
+{
+  int64_t edges_per_case = 1000000;
+  std::vector<std::string> filters;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:n:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p': model_path = optarg; break;
+      case 'n': edges_per_case = atoll(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-p <model dir>] [-n <edges per case>] [case name filter...]\n", argv[0]);
+        return -1;
+    }
+  }
+
+  for (int i=optind; i<argc; i++)
+    filters.push_back(argv[i]);
+
+  atexit(remove_tmp_files);
+
+  kernel = new Dpi_kernel();
+  kernel->set_quiet(true);
+
+  declare_spiflash();
+  declare_spiram();
+  declare_hyperram();
+  declare_spim_verif();
+  declare_nina();
+  declare_ili9341();
+  declare_eeprom();
+  declare_microphone();
+
+  kernel->start();
+
+  printf("%-16s %-22s %12s %10s %12s\n", "model", "command", "edges", "ns/edge", "bytes/s");
+
+  for (auto &bench_case: cases)
+  {
+    std::string name = bench_case.model + " " + bench_case.command;
+    bool selected = filters.size() == 0;
+    for (auto &filter: filters)
+    {
+      if (name.find(filter) != std::string::npos)
+        selected = true;
+    }
+    if (!selected)
+      continue;
+
+    int64_t bytes = 0;
+    nb_edges = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while (nb_edges < edges_per_case && !kernel->has_failed() && !data_error)
+    {
+      bytes += bench_case.iter();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (kernel->has_failed() || data_error)
+    {
+      printf("%-16s %-22s FAILED\n", bench_case.model.c_str(), bench_case.command.c_str());
+      return -1;
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    printf("%-16s %-22s %12ld %10.1f %12.0f\n", bench_case.model.c_str(), bench_case.command.c_str(),
+      (long)nb_edges, ns / nb_edges, bytes / (ns * 1e-9));
+  }
+
+  kernel->stop();
+
+  return 0;
+}
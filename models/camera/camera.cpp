@@ -20,6 +20,13 @@
 
 #include "dpi/models.hpp"
 #include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #ifdef __MAGICK__
 #include <Magick++.h>
 #endif
@@ -61,15 +68,33 @@ private:
 };
 
 
+/*
+ * Frames of the image stream are decoded by a worker thread, which keeps a
+ * few of them ahead in a bounded queue, already packed as the bytes sent on
+ * the CPI interface, so that the simulation never waits for the images to
+ * be read and converted.
+ */
 class Camera_stream {
 
 public:
-  Camera_stream(Camera *top, string path, int color_mode);
-  bool fetch_image();
-  unsigned int get_pixel();
-  void set_image_size(int width, int height);
+  Camera_stream(Camera *top, string path, int color_mode, int width, int height, int nb_prefetch);
+
+  void start();
+  void stop();
+
+  // Next byte of the current frame
+  inline uint8_t get_byte()
+  {
+    if (this->current_byte == this->frame_size)
+      this->next_frame();
+    return this->frame[this->current_byte++];
+  }
 
 private:
+  void next_frame();
+  void worker_routine();
+  bool decode_frame(std::vector<uint8_t> &frame);
+
   Camera *top;
   string stream_path;
   int frame_index;
@@ -78,23 +103,38 @@ private:
 #endif
   int width;
   int height;
-#ifdef __MAGICK__
-  PixelPacket *image_buffer;
-#endif
-  int current_pixel;
-  int nb_pixel;
   int color_mode;
+
+  // Frame being sent, only accessed by the simulator
+  std::vector<uint8_t> *current_frame;
+  uint8_t *frame;
+  int frame_size;
+  int current_byte;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable cond;
+  // Decoded frames, and frames which can be decoded again
+  std::deque<std::vector<uint8_t> *> ready_frames;
+  std::vector<std::vector<uint8_t> *> free_frames;
+  int nb_prefetch;
+  bool stopping;
+  bool failed;
+  bool error_reported;
+  string error;
 };
 
 
 class Camera : public Dpi_model
 {
   friend class Camera_i2c_slave;
+  friend class Camera_stream;
 
 public:
   Camera(js::config *config, void *handle);
 
   void start();
+  void stop();
 
   void i2c_tx_edge(int64_t timestamp, int scl, int sda);
 
@@ -179,20 +219,23 @@ Camera::Camera(js::config *config, void *handle) : Dpi_model(config, handle)
   std::string color_mode = config->get_child_str("color-mode");
   if (color_mode == "raw")
     this->color_mode = COLOR_MODE_RAW;
+  else if (color_mode == "rgb565")
+    this->color_mode = COLOR_MODE_RGB565;
   else
     this->color_mode = COLOR_MODE_GRAY;
 
   this->width = 324;
   this->height = 244;
 
-  // Default color mode is 16bits RGB565
-  //color_mode = COLOR_MODE_RGB565;
   js::config *stream_config = config->get("image-stream");
   if (stream_config)
   {
+    // Number of frames decoded in advance
+    js::config *prefetch_config = config->get("image-stream-prefetch");
+    int nb_prefetch = prefetch_config ? prefetch_config->get_int() : 2;
+
     string stream_path = stream_config->get_str();
-    this->stream = new Camera_stream(this, stream_path.c_str(), this->color_mode);
-    this->stream->set_image_size(this->width, this->height);
+    this->stream = new Camera_stream(this, stream_path.c_str(), this->color_mode, this->width, this->height, std::max(nb_prefetch, 1));
   }
 
   this->i2c_slave = new Camera_i2c_slave(this, 0x24);
@@ -202,6 +245,9 @@ Camera::Camera(js::config *config, void *handle) : Dpi_model(config, handle)
 
 void Camera::start()
 {
+  if (this->stream)
+    this->stream->start();
+
   if (this->stream)
     create_periodic_handler(this->period/2, (void *)&Camera::dpi_task_stub, this);
 
@@ -213,6 +259,12 @@ void Camera::start()
   this->data = 0;
 }
 
+void Camera::stop()
+{
+  if (this->stream)
+    this->stream->stop();
+}
+
 void Camera::dpi_task_stub(Camera *_this)
 {
   _this->clock_gen();
@@ -261,67 +313,12 @@ void Camera::clock_gen()
       case STATE_SEND_LINE: {
         this->href = 1;
 
-        if (this->color_mode == COLOR_MODE_GRAY)
-        {
+        // The stream gives the bytes already packed for the color mode, RGB565
+        // pixels being sent as 2 bytes
+        if (this->color_mode != COLOR_MODE_RGB565)
           this->bytesel = 1;
-          if (stream)
-          {
-            data = stream->get_pixel();
-          }
 
-          //if (stimImg != NULL) {
-          //  pixel = ((uint32_t *)stimImg[framesel])[(lineptr*width)+2*colptr+offset];
-          //}
-
-          //data = 0.2989 * ((pixel >> 16) & 0xff) +
-          //       0.5870 * ((pixel >>  8) & 0xff) +
-          //       0.1140 * ((pixel >>  0) & 0xff);
-        }
-        else if (this->color_mode == COLOR_MODE_RAW)
-        {
-          this->bytesel = 1;
-
-          int pixel  = 0;
-
-          if (stream)
-          {
-            pixel = stream->get_pixel();
-          }
-
-          // Raw bayer mode. Line 0: BGBG, Line 1: GRGR
-          int line = this->width - this->lineptr -1;
-          if (line & 1)
-          {
-            if (this->colptr & 1)
-              this->data = (pixel >> 16) & 0xff;
-            else
-              this->data = (pixel >> 8) & 0xff;
-          }
-          else
-          {
-            if (this->colptr & 1)
-              this->data = (pixel >> 8) & 0xff;
-            else
-              this->data = (pixel >> 0) & 0xff;
-          }
-        }
-        else
-        {
-          int pixel  = 0;
-
-          if (stream)
-          {
-            pixel = stream->get_pixel();
-          }
-
-          //if (stimImg != NULL) {
-          //  ((uint32_t *)stimImg[framesel])[(lineptr*width)+colptr];
-          //}
-
-          // Coded with RGB565
-          if (bytesel) this->data = (((pixel >> 10) & 0x7) << 5) | (((pixel >> 3) & 0x1f) << 0);
-          else         this->data = (((pixel >> 19) & 0x1f) << 3) | (((pixel >> 13) & 0x7) << 0);
-        }
+        this->data = this->stream ? this->stream->get_byte() : 0;
 
         if (this->bytesel == 1) {
           this->bytesel = 0;
@@ -376,91 +373,191 @@ void Camera::dpi_task()
 }
 
 
-Camera_stream::Camera_stream(Camera *top, string path, int color_mode)
- : top(top), stream_path(path), frame_index(0), current_pixel(0), nb_pixel(0), color_mode(color_mode)
+Camera_stream::Camera_stream(Camera *top, string path, int color_mode, int width, int height, int nb_prefetch)
+ : top(top), stream_path(path), frame_index(0), width(width), height(height), color_mode(color_mode),
+   nb_prefetch(nb_prefetch), stopping(false), failed(false), error_reported(false)
 {
-#ifdef __MAGICK__
-  image_buffer = NULL;
-#endif
+  this->frame_size = width * height * (color_mode == COLOR_MODE_RGB565 ? 2 : 1);
+  this->current_frame = NULL;
+  this->frame = NULL;
+  this->current_byte = this->frame_size;
+
+  // The queue is bounded, so that the frames can be allocated once. One more
+  // is needed for the frame being sent.
+  for (int i=0; i<nb_prefetch+1; i++)
+    this->free_frames.push_back(new std::vector<uint8_t>(this->frame_size));
+}
+
+void Camera_stream::start()
+{
+  this->worker = std::thread(&Camera_stream::worker_routine, this);
+}
+
+void Camera_stream::stop()
+{
+  if (!this->worker.joinable())
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->stopping = true;
+    this->cond.notify_all();
+  }
+
+  this->worker.join();
+}
+
+void Camera_stream::next_frame()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  if (this->current_frame)
+  {
+    this->free_frames.push_back(this->current_frame);
+    this->cond.notify_all();
+  }
+
+  if (this->ready_frames.empty() && !this->failed)
+  {
+    this->top->trace_msg(this->top->trace, 2, "Waiting for frame to be decoded");
+    while (this->ready_frames.empty() && !this->failed)
+      this->cond.wait(lock);
+  }
+
+  if (this->ready_frames.empty())
+  {
+    // The stream could not be read, keep sending a blank frame, the error is
+    // reported once
+    if (!this->error_reported)
+      this->top->fatal("Unable to read image stream (path: %s, error: %s)", this->stream_path.c_str(), this->error.c_str());
+    this->error_reported = true;
+    this->current_frame = this->free_frames.back();
+    this->free_frames.pop_back();
+    memset(this->current_frame->data(), 0, this->frame_size);
+  }
+  else
+  {
+    this->current_frame = this->ready_frames.front();
+    this->ready_frames.pop_front();
+  }
+
+  this->frame = this->current_frame->data();
+  this->current_byte = 0;
 }
 
-void Camera_stream::set_image_size(int width, int height)
+void Camera_stream::worker_routine()
 {
-  this->width = width;
-  this->height = height;
-  nb_pixel = width * height;
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while (1)
+  {
+    while (!this->stopping && ((int)this->ready_frames.size() == this->nb_prefetch || this->free_frames.empty()))
+      this->cond.wait(lock);
+
+    if (this->stopping)
+      return;
+
+    std::vector<uint8_t> *frame = this->free_frames.back();
+    this->free_frames.pop_back();
+
+    // Decoding is done without the lock, the frame is not visible to the
+    // simulator until it is queued
+    lock.unlock();
+    bool ok = this->decode_frame(*frame);
+    lock.lock();
+
+    if (!ok)
+    {
+      this->free_frames.push_back(frame);
+      this->failed = true;
+      this->cond.notify_all();
+      return;
+    }
+
+    this->ready_frames.push_back(frame);
+    this->cond.notify_all();
+  }
 }
 
-bool Camera_stream::fetch_image()
+bool Camera_stream::decode_frame(std::vector<uint8_t> &frame)
 {
+  uint8_t *data = frame.data();
+
+#ifdef __MAGICK__
   char path[strlen(stream_path.c_str()) + 100];
   while(1)
   {
     sprintf(path, stream_path.c_str(), frame_index);
 
-#ifdef __MAGICK__
     try {
       image.read(path);
       break;
     }
     catch( Exception &error_ ) {
       if (frame_index == 0) {
-        throw;
+        this->error = error_.what();
+        return false;
       }
     }
-#endif
 
     frame_index = 0;
   }
 
-  //dpi_print(top->handle, ("Opened image (path: " + string(path) + ")").c_str());
   frame_index++;
 
-#ifdef __MAGICK__
-  image.extent(Geometry(width, height));
+  try {
+    image.extent(Geometry(width, height));
 
-  if (color_mode == COLOR_MODE_GRAY)
-  {
-    image.quantizeColorSpace( GRAYColorspace );
-    image.quantizeColors( 256 );
-    image.quantize( );
+    if (color_mode == COLOR_MODE_GRAY)
+    {
+      image.quantizeColorSpace( GRAYColorspace );
+      image.quantizeColors( 256 );
+      image.quantize( );
+    }
   }
-
-
-  image_buffer = (PixelPacket*) image.getPixels(0, 0, width, height);
-#endif
-
-  return true;
-}
-
-unsigned int Camera_stream::get_pixel()
-{
-#ifdef __MAGICK__
-  if (image_buffer == NULL) fetch_image();
-
-  PixelPacket *pixel = &image_buffer[current_pixel];
-  current_pixel++;
-  if (current_pixel == nb_pixel)
-  {
-    current_pixel = 0;
-    image_buffer = NULL;
+  catch( Exception &error_ ) {
+    this->error = error_.what();
+    return false;
   }
 
-  unsigned int shift = (sizeof(pixel->red) - 1)*8;
-  if (color_mode == COLOR_MODE_GRAY)
-  {
-    return pixel->red >> shift;
-  }
-  else
+  const PixelPacket *pixels = image.getConstPixels(0, 0, width, height);
+  unsigned int shift = (sizeof(pixels->red) - 1)*8;
+
+  for (int line=0; line<height; line++)
   {
-    unsigned char red = pixel->red >> shift;
-    unsigned char green = pixel->green >> shift;
-    unsigned char blue = pixel->blue >> shift;
-    return (red << 16) | (green << 8) | blue;
+    for (int col=0; col<width; col++)
+    {
+      const PixelPacket *pixel = &pixels[line*width + col];
+      uint8_t red = pixel->red >> shift;
+      uint8_t green = pixel->green >> shift;
+      uint8_t blue = pixel->blue >> shift;
+
+      if (color_mode == COLOR_MODE_GRAY)
+      {
+        *data++ = red;
+      }
+      else if (color_mode == COLOR_MODE_RAW)
+      {
+        // Raw bayer mode. Line 0: BGBG, Line 1: GRGR
+        int bayer_line = width - line - 1;
+        if (bayer_line & 1)
+          *data++ = (col & 1) ? red : green;
+        else
+          *data++ = (col & 1) ? green : blue;
+      }
+      else
+      {
+        // Coded with RGB565
+        *data++ = (red & 0xf8) | (green >> 5);
+        *data++ = ((green >> 2) & 0x7) << 5 | (blue >> 3);
+      }
+    }
   }
 #else
-  return 0;
+  memset(data, 0, frame.size());
 #endif
+
+  return true;
 }
 
 
@@ -20,6 +20,7 @@
  */
 
 #include "dpi/models.hpp"
+#include "dpi/mem.hpp"
 #include <stdint.h>
 
 using namespace std;
@@ -66,6 +67,7 @@ public:
   Eeprom(js::config *config, void *handle);
 
   void start();
+  void stop();
 
   void i2c_tx_edge(int64_t timestamp, int scl, int sda);
 
@@ -76,7 +78,7 @@ private:
   I2c_itf *i2c;
   Eeprom_i2c_slave *i2c_slave;
   int size;
-  uint8_t *mem_array;
+  Dpi_mem *mem;
 };
 
 
@@ -88,11 +90,23 @@ Eeprom::Eeprom(js::config *config, void *handle) : Dpi_model(config, handle)
   this->i2c_slave = new Eeprom_i2c_slave(this, 0xA0);
   this->size = 65536;
 
-  this->mem_array = new uint8_t[this->size];
+  this->mem = new Dpi_mem(this->size, 0xFF);
+  this->set_backdoor_mem(this->mem);
+
+  if (this->mem->map_shm_from_config(config))
+    this->fatal("%s", this->mem->get_error().c_str());
 }
 
 void Eeprom::start()
 {
+  if (this->mem->preload_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
+}
+
+void Eeprom::stop()
+{
+  if (this->mem->dump_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
 }
 
 
@@ -156,7 +170,7 @@ void Eeprom_i2c_slave::handle_byte(uint8_t byte)
         else
         {
           this->top->print("Writing memory (address: 0x%x, value: 0x%x)\n", this->pending_addr, byte);
-          this->top->mem_array[this->pending_addr] = byte;
+          this->top->mem->write(this->pending_addr, byte);
         }
       }
       this->pending_addr++;
@@ -168,7 +182,7 @@ void Eeprom_i2c_slave::ack()
 {
   if (this->top->i2c_is_read && this->wait_address == 0)
   {
-    uint8_t byte = this->top->mem_array[this->pending_addr];
+    uint8_t byte = this->top->mem->check_range(this->pending_addr) ? this->top->mem->read(this->pending_addr) : 0xFF;
     this->top->print("Reading memory (address: 0x%x, value: 0x%x)\n", this->pending_addr, byte);
     this->send_byte(byte);
   }
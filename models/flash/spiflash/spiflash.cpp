@@ -20,8 +20,11 @@
  */
 
 #include "dpi/models.hpp"
+#include "dpi/mem.hpp"
+#include "dpi/spi_shifter.hpp"
 #include <stdint.h>
 #include <vector>
+#include <map>
 
 
 typedef enum {
@@ -47,15 +50,175 @@ typedef enum {
 
 #define JEDEC_REG_VALUE 0xABCDEF
 
+// How program and erase busy times are modeled
+typedef enum {
+  // Busy for the time given by the device profile
+  TIMING_REALISTIC,
+  // Busy for a percentage of this time
+  TIMING_SCALED,
+  // Busy for a fixed number of status register reads, whatever the time
+  TIMING_INSTANT
+} Spiflash_timing_e;
+
+typedef enum {
+  CMD_NONE,
+  CMD_READ,
+  CMD_PROGRAM,
+  CMD_ERASE,
+  CMD_READ_REG,
+  CMD_WRITE_REG,
+  CMD_WRITE_ENABLE,
+  CMD_WRITE_DISABLE,
+  CMD_QPI_ENABLE,
+  CMD_QPI_DISABLE,
+  CMD_OPI_ENABLE,
+  CMD_OPI_DISABLE,
+  CMD_RESET_ENABLE,
+  CMD_RESET
+} Spiflash_cmd_action_e;
+
 class Spiflash;
 
+// Description of an opcode, taken from the device profile
+class Spiflash_cmd
+{
+public:
+  std::string name;
+  Spiflash_cmd_action_e action = CMD_NONE;
+  Spiflash_reg_e reg = REG_NONE;
+  // Number of lines used for the address and data phases
+  int address_lanes = 1;
+  int data_lanes = 1;
+  // Dummy cycles between the address and the data, -1 to use the value
+  // from the read parameters register
+  int dummy_cycles = 0;
+  // Size of the erased area, 0 for the whole chip
+  int erase_size = 0;
+  int64_t busy_time = 0;
+  // Only accepted in QPI mode
+  bool qpi_only = false;
+  // Address and data phases are sampled and driven on both edges. For
+  // opi_enable, selects the octal DTR mode.
+  bool dtr = false;
+};
+
+typedef struct {
+  uint8_t opcode;
+  const char *name;
+  Spiflash_cmd_action_e action;
+  Spiflash_reg_e reg;
+  int address_lanes;
+  int data_lanes;
+  int dummy_cycles;
+  int erase_size;
+  int64_t busy_time;
+  bool qpi_only;
+  bool dtr;
+} Spiflash_cmd_desc_t;
+
+// Commands used when no device profile is given
+static const Spiflash_cmd_desc_t spiflash_default_commands[] = {
+  { 0x35, "Enabling QPI mode",         CMD_QPI_ENABLE,    REG_NONE,       1, 1, 0,  0,       0,               false },
+  { 0xF5, "Disabling QPI mode",        CMD_QPI_DISABLE,   REG_NONE,       1, 1, 0,  0,       0,               false },
+  { 0x06, "Set write enable latch",    CMD_WRITE_ENABLE,  REG_NONE,       1, 1, 0,  0,       0,               false },
+  { 0x04, "Unset write enable latch",  CMD_WRITE_DISABLE, REG_NONE,       1, 1, 0,  0,       0,               false },
+  { 0x02, "flash page program",        CMD_PROGRAM,       REG_NONE,       1, 1, 0,  0,       BUSY_TIME_WRITE, false },
+  { 0x05, "Read status register",      CMD_READ_REG,      STATUS_REG,     1, 1, 0,  0,       0,               false },
+  { 0x9F, "Read jedec id",             CMD_READ_REG,      JEDEC_REG,      1, 1, 0,  0,       0,               false },
+  { 0xAF, "Read jedec id",             CMD_READ_REG,      JEDEC_REG,      1, 1, 0,  0,       0,               true  },
+  { 0x65, "Set read parameters",       CMD_WRITE_REG,     READ_PARAM_REG, 1, 1, 0,  0,       0,               false },
+  { 0x63, "Set read parameters",       CMD_WRITE_REG,     READ_PARAM_REG, 1, 1, 0,  0,       0,               false },
+  { 0x38, "SPI quad IO write",         CMD_PROGRAM,       REG_NONE,       1, 4, 0,  0,       BUSY_TIME_WRITE, false },
+  { 0x32, "SPI quad IO write",         CMD_PROGRAM,       REG_NONE,       1, 4, 0,  0,       BUSY_TIME_WRITE, false },
+  { 0xD7, "SPI flash sector erase",    CMD_ERASE,         REG_NONE,       1, 1, 0,  1<<12,   BUSY_TIME_ERASE, false },
+  { 0x20, "SPI flash sector erase",    CMD_ERASE,         REG_NONE,       1, 1, 0,  1<<12,   BUSY_TIME_ERASE, false },
+  { 0x52, "SPI flash sector erase",    CMD_ERASE,         REG_NONE,       1, 1, 0,  1<<15,   BUSY_TIME_ERASE, false },
+  { 0xD8, "SPI flash sector erase",    CMD_ERASE,         REG_NONE,       1, 1, 0,  1<<16,   BUSY_TIME_ERASE, false },
+  { 0x03, "SPI read",                  CMD_READ,          REG_NONE,       1, 1, 0,  0,       0,               false },
+  { 0x0B, "SPI fast read",             CMD_READ,          REG_NONE,       1, 1, -1, 0,       0,               false },
+  { 0x6B, "SPI fast quad read",        CMD_READ,          REG_NONE,       4, 4, 6,  0,       0,               false },
+  { 0xEB, "SPI fast quad read",        CMD_READ,          REG_NONE,       4, 4, 3,  0,       0,               false },
+  { 0xED, "SPI DTR fast quad read",    CMD_READ,          REG_NONE,       4, 4, 6,  0,       0,               false, true },
+  { 0x66, "Reset enable",              CMD_RESET_ENABLE,  REG_NONE,       1, 1, 0,  0,       0,               false },
+  { 0x99, "Reset",                     CMD_RESET,         REG_NONE,       1, 1, 0,  0,       0,               false },
+};
+
+// Decoded preload images, shared by the flash instances which are created
+// together so that an image used by several of them is only parsed once.
+// Images are looked up by path only, whatever the size of the flash, as each
+// flash just applies the part of the image which fits into it.
+// Binary images are directly mapped and thus already shared through the
+// page cache.
+class Spiflash_images
+{
+public:
+  Dpi_mem_image *get(std::string path, std::string format);
+
+private:
+  std::map<std::string, Dpi_mem_image *> images;
+};
+
+// Wear and coverage counters, only allocated when a report is requested.
+// Sectors count their erases, the program commands and the bytes read, and
+// pages have bitmaps telling if they were programmed, read, and read again
+// by a later command, which shows redundant reads.
+class Spiflash_wear
+{
+public:
+  Spiflash_wear(int mem_size, int sector_size, int page_size);
+
+  // Called for each command so that accesses are accounted once per command
+  inline void start_command() { this->last_read_page = -1; this->last_program_page = -1; }
+
+  void read(uint32_t addr, int size);
+  void erase(uint32_t addr, int size);
+
+  inline void program(uint32_t addr)
+  {
+    int page = addr / this->page_size;
+    if (page != this->last_program_page)
+    {
+      this->last_program_page = page;
+      this->sectors[addr / this->sector_size].programs++;
+      set_bit(this->programmed, page);
+    }
+  }
+
+  int dump(std::string path);
+
+private:
+  class Sector
+  {
+  public:
+    uint32_t erases = 0;
+    uint32_t programs = 0;
+    uint64_t read_bytes = 0;
+  };
+
+  static inline void set_bit(std::vector<uint64_t> &bitmap, int bit) { bitmap[bit >> 6] |= 1ULL << (bit & 63); }
+  static inline bool get_bit(std::vector<uint64_t> &bitmap, int bit) { return (bitmap[bit >> 6] >> (bit & 63)) & 1; }
+
+  int sector_size;
+  int page_size;
+  int nb_pages;
+  std::vector<Sector> sectors;
+  std::vector<uint64_t> programmed;
+  std::vector<uint64_t> pages_read;
+  std::vector<uint64_t> reread;
+  int last_read_page = -1;
+  int last_program_page = -1;
+};
+
 class Spiflash_qspi_itf : public Qspi_itf
 {
 public:
   Spiflash_qspi_itf(Spiflash *top) : top(top) {}
   void sck_edge(int64_t timestamp, int sck, int data_0, int data_1, int data_2, int data_3, int mask);
   void edge(int64_t timestamp, int data_0, int data_1, int data_2, int data_3, int mask);
+  void octal_sck_edge(int64_t timestamp, int sck, int data, int mask);
+  void octal_edge(int64_t timestamp, int data, int mask);
   void cs_edge(int64_t timestamp, int cs);
+  int transfer(int64_t timestamp, Qspi_transfer *transfer);
 
 private:
     Spiflash *top;
@@ -68,28 +231,54 @@ class Spiflash : public Dpi_model
   friend class Spiflash_qspi_itf;
 
 public:
-  Spiflash(js::config *config, void *handle);
+  Spiflash(js::config *config, void *handle, Spiflash_images *images);
 
 protected:
 
   void sck_edge(int64_t timestamp, int sck, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
   void edge(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
+  void octal_sck_edge(int64_t timestamp, int sck, int data, int mask);
+  void octal_edge(int64_t timestamp, int data, int mask);
   void cs_edge(int64_t timestamp, int cs);
-  void handle_clk_high(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
-  void handle_clk_low(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
+  int transfer(int64_t timestamp, Qspi_transfer *transfer);
+  void handle_sck_edge(int64_t timestamp, int sck, int lanes);
+  void handle_edge(int64_t timestamp, int lanes);
+  void handle_clk_high(int64_t timestamp, int lanes);
+  void handle_clk_low(int64_t timestamp);
+  void sample(int64_t timestamp, int lanes);
 
 
 private:
 
+  void load_default_profile();
+  void load_profile(std::string path);
   void handle_command(uint8_t cmd);
+  void handle_octal_command(uint32_t value);
+  int get_lanes(int command_lanes);
+  void start_phase();
   void handle_reg_access(uint8_t reg, int64_t timestamp);
+  void handle_address(int64_t timestamp);
+  void handle_write_byte(int64_t timestamp);
+  void handle_read_byte(int64_t timestamp);
+  void load_read_burst();
+  void flush_read_burst();
+  void set_busy(int64_t timestamp, int64_t duration);
+  bool is_busy(int64_t timestamp);
+  void preload(std::string path, std::string format);
   void start(void);
+  void stop();
 
   Spiflash_qspi_itf *qspi0;
 
   Spiflash_state_e state;
 
-  int cmd_count;
+  // Shifters for the lines sampled and driven by the flash
+  Dpi_spi_shifter rx;
+  Dpi_spi_shifter tx;
+  // Next edges of a memory read, and address of the burst, -1 if it is
+  // outside the memory
+  Dpi_spi_read_burst read_burst;
+  int64_t read_burst_addr = -1;
   int prev_sck = 0;
   // TODO: configure default according to flash defaults
   int dummy_cycles = 6;
@@ -99,7 +288,10 @@ private:
   int current_write_page;
   int current_size;
   int current_write_size;
-  unsigned char *data;
+  // Flash content, pages which have never been written are read as erased
+  Dpi_mem *mem;
+  bool persistent;
+  bool persistent_created;
   int nb_bits;
   int nb_write_bits;
   uint32_t byte;
@@ -117,8 +309,21 @@ private:
   bool reset_n_hold = 0;
   uint8_t reg = REG_NONE;
   int jedec_byte = -1;
-  bool quad_command;
-  bool quad_address;
+  // Octal mode, where commands are 16 bits (opcode and inverted opcode) and
+  // all phases use 8 lanes, and octal DTR mode where everything is
+  // transferred on both edges
+  bool opi = false;
+  bool dopi = false;
+  // Mode entered when CS is released after an opi_enable command
+  bool pending_opi = false;
+  bool pending_dopi = false;
+  // Lanes of the current command and whether its current phase is
+  // transferred on both edges
+  int address_lanes = 1;
+  int data_lanes = 1;
+  bool dtr = false;
+  // Half cycle of a double transfer rate phase in edge mode
+  int dtr_beat = 0;
   uint32_t current_addr;
   uint8_t current_data;
   bool is_write = false;
@@ -133,27 +338,245 @@ private:
 
   int64_t timestamp_busy = 0;
   int64_t busy_time = 0;
+  Spiflash_timing_e timing = TIMING_REALISTIC;
+  int timing_scale = 100;
+  int timing_polls = 1;
+  // Number of status reads still reporting busy in instant mode
+  int busy_polls = 0;
   
+  // Opcode dispatch table and device parameters from the profile
+  Spiflash_cmd commands[256];
+  uint32_t jedec_id = JEDEC_REG_VALUE;
+  int64_t erase_busy_time = 0;
+  int64_t program_busy_time = 0;
+
+  Spiflash_images *images;
+  Spiflash_wear *wear = NULL;
   void *trace;
 };
 
 
-Spiflash::Spiflash(js::config *config, void *handle) : Dpi_model(config, handle)
+Dpi_mem_image *Spiflash_images::get(std::string path, std::string format)
+{
+  auto it = this->images.find(path);
+  if (it != this->images.end())
+    return it->second;
+
+  Dpi_mem_image *image = new Dpi_mem_image();
+  this->images[path] = image;
+  image->load(path, format);
+
+  return image;
+}
+
+Spiflash_wear::Spiflash_wear(int mem_size, int sector_size, int page_size)
+: sector_size(sector_size), page_size(page_size)
+{
+  this->nb_pages = (mem_size + page_size - 1) / page_size;
+  this->sectors.resize((mem_size + sector_size - 1) / sector_size);
+  this->programmed.resize((this->nb_pages + 63) / 64);
+  this->pages_read.resize((this->nb_pages + 63) / 64);
+  this->reread.resize((this->nb_pages + 63) / 64);
+}
+
+void Spiflash_wear::read(uint32_t addr, int size)
+{
+  int first_page = addr / this->page_size;
+  int last_page = (addr + size - 1) / this->page_size;
+
+  for (int page=first_page; page<=last_page; page++)
+  {
+    if (page == this->last_read_page)
+      continue;
+
+    this->last_read_page = page;
+    if (get_bit(this->pages_read, page))
+      set_bit(this->reread, page);
+    set_bit(this->pages_read, page);
+  }
+
+  while (size)
+  {
+    int iter_size = std::min(size, this->sector_size - (int)(addr % this->sector_size));
+    this->sectors[addr / this->sector_size].read_bytes += iter_size;
+    addr += iter_size;
+    size -= iter_size;
+  }
+}
+
+void Spiflash_wear::erase(uint32_t addr, int size)
+{
+  for (int sector=addr / this->sector_size; sector<=(int)((addr + size - 1) / this->sector_size); sector++)
+  {
+    this->sectors[sector].erases++;
+  }
+}
+
+int Spiflash_wear::dump(std::string path)
+{
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == NULL)
+    return -1;
+
+  uint64_t erases = 0, programs = 0, read_bytes = 0;
+  uint32_t erase_min = UINT32_MAX, erase_max = 0;
+  int nb_erased = 0;
+
+  for (auto &sector: this->sectors)
+  {
+    erases += sector.erases;
+    programs += sector.programs;
+    read_bytes += sector.read_bytes;
+    if (sector.erases)
+    {
+      nb_erased++;
+      erase_min = std::min(erase_min, sector.erases);
+      erase_max = std::max(erase_max, sector.erases);
+    }
+  }
+
+  int pages_programmed = 0, pages_read = 0, pages_reread = 0;
+  for (size_t i=0; i<this->programmed.size(); i++)
+  {
+    pages_programmed += __builtin_popcountll(this->programmed[i]);
+    pages_read += __builtin_popcountll(this->pages_read[i]);
+    pages_reread += __builtin_popcountll(this->reread[i]);
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"sector_size\": %d,\n  \"page_size\": %d,\n", this->sector_size, this->page_size);
+  fprintf(file, "  \"erases\": %lu,\n  \"programs\": %lu,\n  \"read_bytes\": %lu,\n", (unsigned long)erases, (unsigned long)programs, (unsigned long)read_bytes);
+  fprintf(file, "  \"erased_sectors\": %d,\n  \"erase_min\": %u,\n  \"erase_max\": %u,\n", nb_erased, nb_erased ? erase_min : 0, erase_max);
+  fprintf(file, "  \"pages_programmed\": %d,\n  \"pages_read\": %d,\n  \"pages_reread\": %d,\n", pages_programmed, pages_read, pages_reread);
+  fprintf(file, "  \"sectors\": [");
+
+  // Only sectors which have been accessed are reported
+  bool first = true;
+  int pages_per_sector = this->sector_size / this->page_size;
+  for (size_t i=0; i<this->sectors.size(); i++)
+  {
+    Sector *sector = &this->sectors[i];
+    if (sector->erases == 0 && sector->programs == 0 && sector->read_bytes == 0)
+      continue;
+
+    int nb_programmed = 0, nb_read = 0, nb_reread = 0;
+    for (int page=i*pages_per_sector; page<(int)(i+1)*pages_per_sector && page<this->nb_pages; page++)
+    {
+      nb_programmed += get_bit(this->programmed, page);
+      nb_read += get_bit(this->pages_read, page);
+      nb_reread += get_bit(this->reread, page);
+    }
+
+    fprintf(file, "%s\n    { \"addr\": \"0x%8.8lx\", \"erases\": %u, \"programs\": %u, \"read_bytes\": %lu, \"pages_programmed\": %d, \"pages_read\": %d, \"pages_reread\": %d }",
+      first ? "" : ",", (unsigned long)i * this->sector_size, sector->erases, sector->programs, (unsigned long)sector->read_bytes, nb_programmed, nb_read, nb_reread);
+    first = false;
+  }
+
+  fprintf(file, "\n  ]\n}\n");
+  fclose(file);
+
+  return 0;
+}
+
+Spiflash::Spiflash(js::config *config, void *handle, Spiflash_images *images) : Dpi_model(config, handle), images(images)
 {
   this->mem_size = config->get("mem_size")->get_int();
   verbose = true; //config->get("verbose")->get_bool();
   print("Creating SPIFLASH model (mem_size: 0x%x)", this->mem_size);
-  data = new unsigned char[mem_size];
-  memset(data, 0xFF, mem_size);
+
+  this->mem = new Dpi_mem(this->mem_size, 0xFF);
+  this->set_backdoor_mem(this->mem);
+
+  this->load_default_profile();
+  js::config *profile_conf = config->get("profile");
+  if (profile_conf != NULL)
+  {
+    this->load_profile(profile_conf->get_str());
+  }
+
+  js::config *wear_conf = config->get("wear_report");
+  if (wear_conf != NULL)
+  {
+    js::config *sector_size_conf = config->get("wear_sector_size");
+    int sector_size = sector_size_conf ? sector_size_conf->get_int() : 4096;
+    if (sector_size < this->page_size || sector_size % this->page_size)
+      this->fatal("Wear sector size must be a multiple of the page size (sector_size: %d, page_size: %d)", sector_size, this->page_size);
+    else
+      this->wear = new Spiflash_wear(this->mem_size, sector_size, this->page_size);
+  }
+
+  // Optionally the content is stored into a file so that what is programmed
+  // is kept from one run to another
+  this->persistent = false;
+  js::config *persistent_file_conf = config->get("persistent_file");
+  if (persistent_file_conf != NULL)
+  {
+    std::string path = persistent_file_conf->get_str();
+    int created = this->mem->map_persistent(path);
+    if (created == -1)
+    {
+      this->fatal("Unable to map persistent file (path: %s, error: %s)", path.c_str(), this->mem->get_error().c_str());
+    }
+    else
+    {
+      this->persistent = true;
+      this->persistent_created = created;
+    }
+  }
+
+  // The content can also be put in shared memory so that external tools can
+  // look at it while the simulation is running
+  if (this->mem->map_shm_from_config(config))
+    this->fatal("%s", this->mem->get_error().c_str());
+
   qspi0 = new Spiflash_qspi_itf(this);
   create_itf("input", static_cast<Dpi_itf *>(qspi0));
 
   this->current_cs = 1;
   this->tx_file = NULL;
 
-  this->state = STATE_GET_CMD;
-  this->cmd_count = 0;
   this->qpi = false;
+  this->state = STATE_GET_CMD;
+  this->start_phase();
+
+  js::config *mode_conf = config->get("mode");
+  if (mode_conf != NULL)
+  {
+    std::string mode = mode_conf->get_str();
+    if (mode == "qpi")
+      this->qpi = true;
+    else if (mode == "opi")
+      this->opi = true;
+    else if (mode == "dopi")
+      this->opi = this->dopi = true;
+    else if (mode != "spi")
+      this->fatal("Unknown flash mode (mode: %s)", mode.c_str());
+    this->start_phase();
+  }
+
+  js::config *timing_conf = config->get("timing");
+  if (timing_conf != NULL)
+  {
+    std::string timing = timing_conf->get_str();
+    if (timing == "scaled")
+    {
+      this->timing = TIMING_SCALED;
+      js::config *scale_conf = config->get("timing_scale");
+      if (scale_conf != NULL)
+        this->timing_scale = scale_conf->get_int();
+    }
+    else if (timing == "instant")
+    {
+      this->timing = TIMING_INSTANT;
+      js::config *polls_conf = config->get("timing_polls");
+      if (polls_conf != NULL)
+        this->timing_polls = polls_conf->get_int();
+    }
+    else if (timing != "realistic")
+    {
+      this->fatal("Unknown flash timing mode (timing: %s)", timing.c_str());
+    }
+  }
 
   this->trace = this->trace_new(config->get_child_str("name").c_str());
 }
@@ -173,51 +596,67 @@ void Spiflash::start(void)
     stim_file_conf = this->get_config()->get("preload_file");
   }
 
+  // With a persistent file, the images are only used to initialize it
+  if (this->persistent && !this->persistent_created)
+    return;
+
+  // These keys always took raw binaries, the other formats must be asked for
+  // explicitly so that a binary which looks like another format is not parsed
   if (stim_file_conf != NULL)
   {
-    std::string path = stim_file_conf->get_str();
-    //this->get_trace()->msg("Preloading memory with stimuli file (path: %s)\n", path.c_str());
-
-    FILE *file = fopen(path.c_str(), "rb");
-    if (file == NULL)
-    {
-      //this->get_trace()->fatal("Unable to open stim file: %s, %s\n", path.c_str(), strerror(errno));
-      return;
-    }
-    if (fread(this->data, 1, mem_size, file) == 0)
-    {
-      //this->get_trace()->fatal("Failed to read stim file: %s, %s\n", path.c_str(), strerror(errno));
-      return;
-    }
+    js::config *format_conf = this->get_config()->get("preload_format");
+    this->preload(stim_file_conf->get_str(), format_conf ? format_conf->get_str() : "bin");
   }
 
   js::config *slm_stim_file_conf = this->get_config()->get("slm_stim_file");
   if (slm_stim_file_conf != NULL)
   {
-    std::string path = stim_file_conf->get_str();
-    //this->get_trace()->msg("Preloading memory with slm stimuli file (path: %s)\n", path.c_str());
+    this->preload(slm_stim_file_conf->get_str(), "slm");
+  }
+}
 
-    FILE *file = fopen(path.c_str(), "r");
-    if (file == NULL)
-    {
-      //this->get_trace()->fatal("Unable to open stim file: %s, %s\n", path.c_str(), strerror(errno));
-      return;
-    }
+void Spiflash::stop()
+{
+  if (this->mem->dump_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
 
-    while(1)
-    {
-      unsigned int addr, value;
-      int err;
-      if ((err = fscanf(file, "@%x %x\n", &addr, &value)) != 2) {
-        if (err == EOF) break;
-        //this->get_trace()->fatal("Incorrect stimuli file (path: %s)\n", path.c_str());
-        return;
-      }
-      if (addr < mem_size) this->data[addr] = value;
-    }
+  if (this->wear)
+  {
+    this->flush_read_burst();
+    std::string path = this->get_config()->get("wear_report")->get_str();
+    if (this->wear->dump(path))
+      this->print("WARNING: unable to write wear report (path: %s)", path.c_str());
   }
 }
 
+void Spiflash::preload(std::string path, std::string format)
+{
+  js::config *base_conf = this->get_config()->get("preload_base");
+
+  if (format == "")
+    format = Dpi_mem_image::get_file_format(path);
+
+  this->trace_msg(this->trace, 1, "Preloading memory (path: %s, format: %s)", path.c_str(), format.c_str());
+
+  if (format == "bin")
+  {
+    if (this->mem->map_file(path))
+      this->print("WARNING: unable to load stim file (path: %s, error: %s)", path.c_str(), this->mem->get_error().c_str());
+    return;
+  }
+
+  Dpi_mem_image *image = this->images->get(path, format);
+  if (image->get_error() != "")
+  {
+    this->print("WARNING: unable to load stim file (path: %s, error: %s)", path.c_str(), image->get_error().c_str());
+    return;
+  }
+
+  uint64_t nb_dropped = image->apply(this->mem, base_conf ? base_conf->get_int() : 0);
+  if (nb_dropped)
+    this->trace_msg(this->trace, 1, "Ignored preload bytes outside the flash (count: %lu)", nb_dropped);
+}
+
 void Spiflash_qspi_itf::cs_edge(int64_t timestamp, int cs)
 {
   top->cs_edge(timestamp, cs);
@@ -233,6 +672,21 @@ void Spiflash_qspi_itf::edge(int64_t timestamp, int data_0, int data_1, int data
   top->edge(timestamp, data_0, data_1, data_2, data_3, mask);
 }
 
+void Spiflash_qspi_itf::octal_sck_edge(int64_t timestamp, int sck, int data, int mask)
+{
+  top->octal_sck_edge(timestamp, sck, data, mask);
+}
+
+void Spiflash_qspi_itf::octal_edge(int64_t timestamp, int data, int mask)
+{
+  top->octal_edge(timestamp, data, mask);
+}
+
+int Spiflash_qspi_itf::transfer(int64_t timestamp, Qspi_transfer *transfer)
+{
+  return top->transfer(timestamp, transfer);
+}
+
 void Spiflash::cs_edge(int64_t timestamp, int cs)
 {
   if (this->current_cs == cs) return;
@@ -243,7 +697,7 @@ void Spiflash::cs_edge(int64_t timestamp, int cs)
   if (cs == 1) {
     qspi0->set_data(3);
     this->state = STATE_GET_CMD;
-    this->cmd_count = 0;
+    this->start_phase();
     if(this->wren && this->is_write && this->reg)
     {
       this->wren = 0;
@@ -251,20 +705,26 @@ void Spiflash::cs_edge(int64_t timestamp, int cs)
     }
     if(this->wren && this->is_write && !this->reg)
     {
-      this->timestamp_busy = timestamp;
-      this->busy_time = BUSY_TIME_WRITE;
+      this->set_busy(timestamp, this->program_busy_time);
       this->wren = 0;
       this->is_write = 0;
     }
     if(this->wren && this->is_erase)
     {
-      this->timestamp_busy = timestamp;
-      this->busy_time = BUSY_TIME_ERASE;
+      this->set_busy(timestamp, this->erase_busy_time);
       this->wren = 0;
       this->is_erase = 0;
     }
     this->is_read = false;
     this->reg = REG_NONE;
+    if (this->pending_opi)
+    {
+      this->trace_msg(this->trace, 1, "Entering %s mode", this->pending_dopi ? "octal DTR" : "octal");
+      this->opi = true;
+      this->dopi = this->pending_dopi;
+      this->pending_opi = false;
+      this->start_phase();
+    }
   }
 
   if (cs == 0)
@@ -276,185 +736,366 @@ void Spiflash::edge(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio
 {
   this->trace_msg(this->trace, 4, "Edge (timestamp: %ld, data_0: %d, data_1: %d, data_2: %d, data_3: %d, mask: 0x%x)", timestamp, sdio0, sdio1, sdio2, sdio3, mask);
 
-  handle_clk_high(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
-  handle_clk_low(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
+  this->handle_edge(timestamp, Dpi_spi_shifter::pack(sdio0, sdio1, sdio2, sdio3));
 }
 
-void Spiflash::handle_command(uint8_t cmd)
+void Spiflash::octal_edge(int64_t timestamp, int data, int mask)
 {
-  this->trace_msg(this->trace, 2, "Handling command 0x%2.2x", this->current_cmd);
+  this->trace_msg(this->trace, 4, "Edge (timestamp: %ld, data: 0x%2.2x, mask: 0x%x)", timestamp, data, mask);
 
-  this->quad_command = false;
-  this->quad_address = false;
+  this->handle_edge(timestamp, data);
+}
 
-  if (this->current_cmd == 0x35)
-  {
-    if(this->reset_enable)
-    {
-      this->trace_msg(this->trace, 1, "ERROR: enabling QPI while reset enable");
-    }
-    else
-    {
-      this->trace_msg(this->trace, 1, "Enabling QPI mode");
-      this->qpi = true;
-    }
-  }
-  else if (this->current_cmd == 0xF5)
-  {
-    this->trace_msg(this->trace, 1, "Disabling QPI mode");
-    this->qpi = false;
-  }
-  else if (this->current_cmd == 0x06)
-  {
-    this->trace_msg(this->trace, 1, "Set write enable latch");
-    this->wren = 1;
-  }
-  else if (this->current_cmd == 0x04)
-  {
-    this->trace_msg(this->trace, 1, "Unset write enable latch");
-    this->wren = 0;
-  }
-  else if (this->current_cmd == 0x02)
-  {
-    this->trace_msg(this->trace, 1, "flash page program");
-    this->quad_command = false;
-    this->state = STATE_GET_ADDRESS;
-    this->is_write = true;
-    this->wait_cycles = 0;
-  }
-  else if (this->current_cmd == 0x05)
-  {
-    this->trace_msg(this->trace, 1, "Read status register");
-    this->quad_command = false;
-    this->state = STATE_GET_DATA;
-    this->reg = STATUS_REG;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = 0;
-  }
-  else if (this->current_cmd == 0x9f)
-  {
-    this->trace_msg(this->trace, 1, "Read jedec id");
-    this->quad_command = false;
-    this->state = STATE_GET_DATA;
-    this->reg = JEDEC_REG;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = 0;
-    this->jedec_byte = 2;
-  }
-  else if (this->current_cmd == 0xaf)
-  {
-    if(!this->qpi)
-    {
-      this->fatal("trying to use qpi jedec read in spi mode");
-    }
-    this->trace_msg(this->trace, 1, "Read jedec id");
-    this->quad_command = false;
-    this->state = STATE_GET_DATA;
-    this->reg = JEDEC_REG;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = 0;
-    this->jedec_byte = 2;
-  }
-  else if ((this->current_cmd == 0x65) || this->current_cmd == 0x63)
-  {
-    this->trace_msg(this->trace, 1, "Set read parameters");
-    this->quad_command = false;
-    this->state = STATE_GET_DATA;
-    this->reg = READ_PARAM_REG;
-    this->is_write = true;
-    this->wait_cycles = 0;
-  }
-  else if ((this->current_cmd == 0x38) || (this->current_cmd == 0x32))
+// In edge mode, each call is a full cycle, except in double transfer rate
+// phases where it is half a cycle, so that dummy cycles are then counted
+// every 2 calls
+void Spiflash::handle_edge(int64_t timestamp, int lanes)
+{
+  if (this->dtr && this->state == STATE_WAIT_CYCLES)
   {
-    this->trace_msg(this->trace, 1, "SPI quad IO write");
-    this->quad_command = true;
-    this->state = STATE_GET_ADDRESS;
-    this->is_write = true;
-    this->wait_cycles = 0;
+    this->dtr_beat ^= 1;
+    if (this->dtr_beat)
+      return;
   }
-  else if ((this->current_cmd == 0xD7) || (this->current_cmd == 0x20))
+
+  this->handle_clk_high(timestamp, lanes);
+  this->handle_clk_low(timestamp);
+}
+
+void Spiflash::handle_command(uint8_t cmd)
+{
+  Spiflash_cmd *command = &this->commands[cmd];
+
+  this->trace_msg(this->trace, 2, "Handling command 0x%2.2x", this->current_cmd);
+
+  this->qspi0->stats_command(cmd);
+
+  if (this->wear)
+    this->wear->start_command();
+
+  this->address_lanes = 1;
+  this->data_lanes = 1;
+  this->dtr = this->dopi;
+
+  if (command->action == CMD_NONE)
+    return;
+
+  if (command->qpi_only && !this->qpi)
   {
-    this->trace_msg(this->trace, 1, "SPI flash sector erase");
-    this->state = STATE_GET_ADDRESS;
-    this->is_erase = true;
-    this->erase_size = (1<<12);
-    this->wait_cycles = 0;
+    this->fatal("trying to use qpi command in spi mode (cmd: 0x%2.2x)", cmd);
   }
-  else if ((this->current_cmd == 0x52))
+
+  this->trace_msg(this->trace, 1, "%s", command->name.c_str());
+
+  this->address_lanes = command->address_lanes;
+  this->data_lanes = command->data_lanes;
+  this->dtr = this->dopi || command->dtr;
+  this->wait_cycles = command->dummy_cycles == -1 ? this->dummy_cycles : command->dummy_cycles;
+
+  switch (command->action)
   {
-    this->trace_msg(this->trace, 1, "SPI flash sector erase");
-    this->state = STATE_GET_ADDRESS;
-    this->is_erase = true;
-    this->erase_size = (1<<15);
-    this->wait_cycles = 0;
+    case CMD_QPI_ENABLE:
+      if(this->reset_enable)
+      {
+        this->trace_msg(this->trace, 1, "ERROR: enabling QPI while reset enable");
+      }
+      else
+      {
+        this->qpi = true;
+      }
+      break;
+
+    case CMD_QPI_DISABLE:
+      this->qpi = false;
+      break;
+
+    case CMD_OPI_ENABLE:
+      // Real devices get the mode through a configuration register write,
+      // whose address and data are ignored here. The new mode is only
+      // entered once CS is released.
+      this->pending_opi = true;
+      this->pending_dopi = command->dtr;
+      this->state = STATE_WAIT_CS_EDGE;
+      break;
+
+    case CMD_OPI_DISABLE:
+      this->opi = false;
+      this->dopi = false;
+      break;
+
+    case CMD_WRITE_ENABLE:
+      this->wren = 1;
+      break;
+
+    case CMD_WRITE_DISABLE:
+      this->wren = 0;
+      break;
+
+    case CMD_PROGRAM:
+      this->state = STATE_GET_ADDRESS;
+      this->is_write = true;
+      this->program_busy_time = command->busy_time;
+      break;
+
+    case CMD_READ_REG:
+      this->state = STATE_GET_DATA;
+      this->reg = command->reg;
+      this->is_write = false;
+      this->is_read = true;
+      if (command->reg == JEDEC_REG)
+        this->jedec_byte = 2;
+      break;
+
+    case CMD_WRITE_REG:
+      this->state = STATE_GET_DATA;
+      this->reg = command->reg;
+      this->is_write = true;
+      break;
+
+    case CMD_ERASE:
+      this->is_erase = true;
+      this->erase_size = command->erase_size;
+      this->erase_busy_time = command->busy_time;
+      if (command->erase_size)
+      {
+        this->state = STATE_GET_ADDRESS;
+      }
+      else if (this->wren)
+      {
+        // Chip erase, there is no address
+        this->trace_msg(this->trace, 2, "Erasing chip");
+        this->mem->fill(0, this->mem_size, 0xFF);
+        if (this->wear)
+          this->wear->erase(0, this->mem_size);
+        this->state = STATE_BUSY;
+      }
+      break;
+
+    case CMD_READ:
+      this->state = STATE_GET_ADDRESS;
+      this->is_write = false;
+      this->is_read = true;
+      break;
+
+    case CMD_RESET_ENABLE:
+      if(this->qpi)
+      {
+        this->fatal("ERROR: Reset enable with QPI enabled");
+      }
+      else
+      {
+        this->reset_enable = true;
+      }
+      break;
+
+    case CMD_RESET:
+      // Octal modes are volatile and left on reset
+      if (this->reset_enable && this->opi)
+      {
+        this->trace_msg(this->trace, 1, "Leaving octal mode");
+        this->opi = false;
+        this->dopi = false;
+      }
+      break;
+
+    default:
+      break;
   }
-  else if ((this->current_cmd == 0xD8))
+
+  this->start_phase();
+}
+
+void Spiflash::handle_octal_command(uint32_t value)
+{
+  uint8_t cmd = value >> 8;
+
+  if ((value & 0xff) != (~cmd & 0xff))
   {
-    this->trace_msg(this->trace, 1, "SPI flash sector erase");
-    this->state = STATE_GET_ADDRESS;
-    this->is_erase = true;
-    this->erase_size = (1<<16);
-    this->wait_cycles = 0;
+    this->fatal("Received invalid octal command extension (cmd: 0x%2.2x, extension: 0x%2.2x)", cmd, value & 0xff);
+    return;
   }
-  else if (this->current_cmd == 0x03)
+
+  this->current_cmd = cmd;
+  this->handle_command(cmd);
+}
+
+// Number of lanes of a phase, the command gives it only in SPI mode
+int Spiflash::get_lanes(int command_lanes)
+{
+  return this->opi ? 8 : this->qpi ? 4 : command_lanes;
+}
+
+// Prepare the shifters for the phase of the new state
+void Spiflash::start_phase()
+{
+  this->flush_read_burst();
+  this->dtr_beat = 0;
+
+  switch (this->state)
   {
-    this->trace_msg(this->trace, 1, "SPI read");
-    this->quad_command = false;
-    this->state = STATE_GET_ADDRESS;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = 0;
+    case STATE_GET_CMD:
+      this->dtr = this->dopi;
+      this->rx.start(this->opi ? 16 : 8, this->get_lanes(1));
+      break;
+
+    case STATE_GET_ADDRESS:
+      this->rx.start(this->opi ? 32 : 24, this->get_lanes(this->address_lanes));
+      break;
+
+    case STATE_GET_DATA:
+      this->rx.start(8, this->get_lanes(this->data_lanes));
+      this->tx.start(8, this->get_lanes(this->data_lanes));
+      break;
+
+    default:
+      break;
   }
-  else if (this->current_cmd == 0x0B)
+}
+
+void Spiflash::load_default_profile()
+{
+  for (auto &desc: spiflash_default_commands)
   {
-    this->trace_msg(this->trace, 1, "SPI fast read");
-    this->quad_command = false;
-    this->state = STATE_GET_ADDRESS;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = this->dummy_cycles;
+    Spiflash_cmd *command = &this->commands[desc.opcode];
+    command->name = desc.name;
+    command->action = desc.action;
+    command->reg = desc.reg;
+    command->address_lanes = desc.address_lanes;
+    command->data_lanes = desc.data_lanes;
+    command->dummy_cycles = desc.dummy_cycles;
+    command->erase_size = desc.erase_size;
+    command->busy_time = desc.busy_time;
+    command->qpi_only = desc.qpi_only;
+    command->dtr = desc.dtr;
   }
-  else if (this->current_cmd == 0x6B)
+}
+
+static int profile_get_int(js::config *config, std::string name, int default_value)
+{
+  js::config *value = config->get(name);
+  return value ? value->get_int() : default_value;
+}
+
+static bool profile_get_bool(js::config *config, std::string name, bool default_value)
+{
+  js::config *value = config->get(name);
+  return value ? value->get_bool() : default_value;
+}
+
+static std::string profile_get_str(js::config *config, std::string name, std::string default_value)
+{
+  js::config *value = config->get(name);
+  return value ? value->get_str() : default_value;
+}
+
+// Load a device profile, see the profiles directory for examples.
+// The commands of the profile replace the default ones.
+void Spiflash::load_profile(std::string path)
+{
+  static const std::map<std::string, Spiflash_cmd_action_e> actions = {
+    { "read",          CMD_READ },
+    { "program",       CMD_PROGRAM },
+    { "erase",         CMD_ERASE },
+    { "read_reg",      CMD_READ_REG },
+    { "write_reg",     CMD_WRITE_REG },
+    { "write_enable",  CMD_WRITE_ENABLE },
+    { "write_disable", CMD_WRITE_DISABLE },
+    { "qpi_enable",    CMD_QPI_ENABLE },
+    { "qpi_disable",   CMD_QPI_DISABLE },
+    { "opi_enable",    CMD_OPI_ENABLE },
+    { "opi_disable",   CMD_OPI_DISABLE },
+    { "reset_enable",  CMD_RESET_ENABLE },
+    { "reset",         CMD_RESET },
+  };
+
+  static const std::map<std::string, Spiflash_reg_e> regs = {
+    { "none",       REG_NONE },
+    { "status",     STATUS_REG },
+    { "read_param", READ_PARAM_REG },
+    { "jedec",      JEDEC_REG },
+  };
+
+  js::config *profile = js::import_config_from_file(path);
+  if (profile == NULL)
   {
-    this->trace_msg(this->trace, 1, "SPI fast quad read");
-    this->quad_command = true;
-    this->quad_address = true;
-    this->state = STATE_GET_ADDRESS;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = 6;
+    this->fatal("Unable to load flash profile (path: %s)", path.c_str());
+    return;
   }
-  else if (this->current_cmd == 0xEB)
+
+  this->print("Loading flash profile (path: %s, name: %s)", path.c_str(), profile_get_str(profile, "name", "").c_str());
+
+  this->jedec_id = strtoul(profile_get_str(profile, "jedec_id", "0xABCDEF").c_str(), NULL, 0);
+  this->page_size = profile_get_int(profile, "page_size", this->page_size);
+  this->page_mask = this->page_size - 1;
+  this->dummy_cycles = profile_get_int(profile, "dummy_cycles", this->dummy_cycles);
+
+  js::config *commands = profile->get("commands");
+  if (commands == NULL)
+    return;
+
+  for (auto &command: this->commands)
   {
-    this->trace_msg(this->trace, 1, "SPI fast quad read");
-    this->quad_command = true;
-    this->quad_address = true;
-    this->state = STATE_GET_ADDRESS;
-    this->is_write = false;
-    this->is_read = true;
-    this->wait_cycles = 3;
+    command = Spiflash_cmd();
   }
-  else if (this->current_cmd == 0x66)
+
+  for (auto &x: commands->get_childs())
   {
-    this->trace_msg(this->trace, 1, "Reset enable");
-    if(this->qpi)
-    {
-      this->fatal("ERROR: Reset enable with QPI enabled");
-    }
-    else
+    int opcode = strtoul(x.first.c_str(), NULL, 0);
+    js::config *desc = x.second;
+    std::string action = profile_get_str(desc, "action", "");
+    std::string reg = profile_get_str(desc, "reg", "none");
+
+    if (opcode < 0 || opcode > 255 || actions.find(action) == actions.end() || regs.find(reg) == regs.end())
     {
-      this->reset_enable = true;
+      this->fatal("Invalid flash profile command (path: %s, opcode: %s)", path.c_str(), x.first.c_str());
+      return;
     }
+
+    Spiflash_cmd *command = &this->commands[opcode];
+    command->name = profile_get_str(desc, "name", action);
+    command->action = actions.at(action);
+    command->reg = regs.at(reg);
+    command->address_lanes = profile_get_int(desc, "address_lanes", 1);
+    command->data_lanes = profile_get_int(desc, "data_lanes", 1);
+    command->dummy_cycles = profile_get_int(desc, "dummy_cycles", 0);
+    command->erase_size = profile_get_int(desc, "erase_size", 0);
+    command->busy_time = (int64_t)profile_get_int(desc, "busy_time_us", 0) * 1000000;
+    command->qpi_only = profile_get_bool(desc, "qpi_only", false);
+    command->dtr = profile_get_bool(desc, "dtr", false);
   }
-  else if (this->current_cmd == 0x99)
+}
+
+
+void Spiflash::set_busy(int64_t timestamp, int64_t duration)
+{
+  this->timestamp_busy = timestamp;
+
+  switch (this->timing)
   {
-    this->trace_msg(this->trace, 1, "Reset");
+    case TIMING_REALISTIC:
+      this->busy_time = duration;
+      break;
+
+    case TIMING_SCALED:
+      this->busy_time = duration * this->timing_scale / 100;
+      break;
+
+    case TIMING_INSTANT:
+      this->busy_time = 0;
+      this->busy_polls = this->timing_polls;
+      break;
   }
+
+  this->trace_msg(this->trace, 2, "Flash busy (duration: %ld, polls: %d)", this->busy_time, this->busy_polls);
 }
 
+bool Spiflash::is_busy(int64_t timestamp)
+{
+  if (this->timing == TIMING_INSTANT)
+    return this->busy_polls > 0;
+
+  return (this->timestamp_busy + this->busy_time) > timestamp;
+}
 
 void Spiflash::handle_reg_access(uint8_t reg, int64_t timestamp)
 {
@@ -486,7 +1127,11 @@ void Spiflash::handle_reg_access(uint8_t reg, int64_t timestamp)
   {
     if (this->reg == STATUS_REG)
     { // read block protection, quad enable and status reg protection
-      this->current_data = ((this->timestamp_busy + this->busy_time) > timestamp)
+      bool busy = this->is_busy(timestamp);
+      if (busy && this->timing == TIMING_INSTANT)
+        this->busy_polls--;
+
+      this->current_data = busy
         | ((this->block_protection << 0x2))
         | ((this->qpi << 0x6)) | ((this->status_protected << 0x7));
     }
@@ -502,7 +1147,7 @@ void Spiflash::handle_reg_access(uint8_t reg, int64_t timestamp)
       {// if no new command and already done, wrap around
         jedec_byte = 2;
       }
-      this->current_data = JEDEC_REG_VALUE >> this->jedec_byte * 8;
+      this->current_data = this->jedec_id >> this->jedec_byte * 8;
       this->jedec_byte --;
     }
     else
@@ -513,175 +1158,283 @@ void Spiflash::handle_reg_access(uint8_t reg, int64_t timestamp)
   this->trace_msg(this->trace, 2, "Read register (reg: 0x%6.6x, value: 0x%2.2x)", this->reg, this->current_data);
 }
 
-void Spiflash::handle_clk_high(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask)
+void Spiflash::handle_address(int64_t timestamp)
 {
-  if (this->state == STATE_GET_CMD)
+  // Addresses are 4 bytes in octal mode
+  if (!this->opi)
+    this->current_addr = this->current_addr & 0xffffff;
+  if (this->is_write)
+  {
+    this->current_write_page = this->current_addr & ~(this->page_mask);
+  }
+  else if (this->is_erase && this->wren)
   {
-    if (this->qpi)
+    this->trace_msg(this->trace, 2, "Erasing data (addr: 0x%x, size: 0x%2.2x)", this->current_addr, this->erase_size);
+    if (this->current_addr >= this->mem_size)
     {
-      this->current_cmd = (this->current_cmd << 4) | (sdio0 << 0) | (sdio1 << 1) | (sdio2 << 2) | (sdio3 << 3);
-      this->trace_msg(this->trace, 4, "Received command bits (count: %d, pending: %x, bit0: %d, bit1: %d, bit2: %d, bit3: %d)", this->cmd_count, this->current_cmd, sdio0, sdio1, sdio2, sdio3);
-      this->cmd_count += 4;
+      this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
+      this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)\n", this->current_addr, this->mem_size);
     }
     else
     {
-      this->current_cmd = (this->current_cmd << 1) | sdio0;
-      this->trace_msg(this->trace, 4, "Received command bit (count: %d, pending: %x, bit: %d)", this->cmd_count, this->current_cmd, sdio0);
-      this->cmd_count++;
-    }
-    if (this->cmd_count == 8)
-    {
-      this->cmd_count = 0;
-      this->handle_command(this->current_cmd);
+      this->mem->fill(this->current_addr, std::min(this->erase_size, this->mem_size - (int)this->current_addr), 0xFF);
+      if (this->wear)
+        this->wear->erase(this->current_addr, std::min(this->erase_size, this->mem_size - (int)this->current_addr));
     }
+    this->state = STATE_BUSY;
   }
-  else if (this->state == STATE_GET_ADDRESS)
+  this->trace_msg(this->trace, 2, "Received address (addr: 0x%6.6x)", this->current_addr);
+  if (this->wait_cycles)
+    this->state = STATE_WAIT_CYCLES;
+  else
+    this->state = STATE_GET_DATA;
+  this->start_phase();
+}
+
+void Spiflash::handle_write_byte(int64_t timestamp)
+{
+  if(this->wren)
   {
-    if (this->qpi || this->quad_address)
+    if (this->reg)
     {
-      this->current_addr = (this->current_addr << 4) | (sdio0 << 0) | (sdio1 << 1) | (sdio2 << 2) | (sdio3 << 3);
-      this->trace_msg(this->trace, 4, "Received address bits (count: %d, pending: %x, bit0: %d, bit1: %d, bit2: %d, bit3: %d)", this->cmd_count, this->current_addr, sdio0, sdio1, sdio2, sdio3);
-      this->cmd_count += 4;
+      this->handle_reg_access(this->reg, timestamp);
+      this->state = STATE_WAIT_CS_EDGE;
     }
-    else
+    else if (this->current_addr >= this->mem_size)
     {
-      this->current_addr = (this->current_addr << 1) | sdio0;
-      this->trace_msg(this->trace, 4, "Received address bit (count: %d, pending: %x, bit: %d)", this->cmd_count, this->current_addr, sdio0);
-      this->cmd_count++;
+      this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
+      this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)\n", this->current_addr, this->mem_size);
     }
-    if (this->cmd_count == 24)
+    else
     {
-      this->cmd_count = 0;
-      this->current_addr = this->current_addr & 0xffffff;
-      if (this->is_write)
+      this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
+      if (this->is_busy(timestamp))
       {
-        this->current_write_page = this->current_addr & ~(this->page_mask);
+        this->fatal("Trying to write while flash is busy");
       }
-      else if (this->is_erase && this->wren)
+      else
       {
-        this->trace_msg(this->trace, 2, "Erasing data (addr: 0x%x, size: 0x%2.2x)", this->current_addr, this->erase_size);
-        if (this->current_addr >= this->mem_size)
+        uint8_t prev_data = this->mem->read(this->current_addr);
+        if (!((~prev_data & ~this->current_data) == ~prev_data))
         {
-          this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
-          this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)\n", this->current_addr, this->mem_size);
+          this->fatal("Trying to write non erased data at 0x%x 0x%2.2x original data:0x%2.2x\n", this->current_addr ,this->current_data,prev_data);
+        }
+        if (this->wear)
+          this->wear->program(this->current_addr);
+        this->mem->write(this->current_addr++, this->current_data);
+        this->qspi0->stats_bytes(1);
+        if(this->current_addr >= (this->current_write_page + this->page_size))
+        {
+          this->current_addr = this->current_addr = this->current_write_page;
         }
-        memset(&(this->data[this->current_addr]), 0xFF, this->erase_size);
-        this->state = STATE_BUSY;
       }
-      this->trace_msg(this->trace, 2, "Received address (addr: 0x%6.6x)", this->current_addr);
-      if (this->wait_cycles)
-        this->state = STATE_WAIT_CYCLES;
-      else
-        this->state = STATE_GET_DATA;
     }
   }
-  else if (this->state == STATE_WAIT_CYCLES)
+}
+
+void Spiflash::handle_read_byte(int64_t timestamp)
+{
+  if (this->reg)
+  {
+    this->handle_reg_access(this->reg, timestamp);
+  }
+  else if (this->current_addr >= this->mem_size)
+  {
+    this->fatal("Trying to read outside memory range (addr: 0x%x, mem size: 0x%x)\n", this->current_addr, this->mem_size);
+  }
+  else
+  {
+    this->current_data = this->mem->read(this->current_addr);
+    this->trace_msg(this->trace, 2, "Read byte from memory (address: 0x%6.6x, value: 0x%2.2x)", this->current_addr, this->current_data);
+    if (this->wear)
+      this->wear->read(this->current_addr, 1);
+    this->current_addr++;
+    this->qspi0->stats_bytes(1);
+  }
+}
+
+void Spiflash::load_read_burst()
+{
+  this->flush_read_burst();
+
+  uint8_t *buffer = this->read_burst.get_buffer();
+  int size = 1;
+
+  if (this->current_addr >= this->mem_size)
+  {
+    this->fatal("Trying to read outside memory range (addr: 0x%x, mem size: 0x%x)\n", this->current_addr, this->mem_size);
+    buffer[0] = this->current_data;
+    this->read_burst_addr = -1;
+  }
+  else
+  {
+    // The range is checked once for the whole burst, which stops at the end
+    // of the memory so that the error is still reported on the first byte
+    // outside
+    size = std::min(DPI_SPI_READ_BURST_SIZE, this->mem_size - (int)this->current_addr);
+    this->mem->read_block(this->current_addr, buffer, size);
+    this->trace_msg(this->trace, 2, "Read burst from memory (address: 0x%6.6x, size: %d)", this->current_addr, size);
+    this->read_burst_addr = this->current_addr;
+    this->current_addr += size;
+    this->current_data = buffer[size - 1];
+  }
+
+  this->read_burst.load(size, this->tx.get_nb_lanes());
+}
+
+// Account the bytes of the current burst which have been sent and drop the
+// others
+void Spiflash::flush_read_burst()
+{
+  int nb_bytes = this->read_burst.get_started_bytes();
+  if (nb_bytes)
+  {
+    this->qspi0->stats_bytes(nb_bytes);
+    if (this->wear && this->read_burst_addr != -1)
+      this->wear->read(this->read_burst_addr, nb_bytes);
+  }
+  this->read_burst.reset();
+}
+
+int Spiflash::transfer(int64_t timestamp, Qspi_transfer *transfer)
+{
+  this->trace_msg(this->trace, 3, "Transfer (timestamp: %ld, cmd: 0x%lx, addr: 0x%lx, is_write: %d, size: %d)", timestamp, transfer->cmd, transfer->addr, transfer->is_write, transfer->size);
+
+  this->cs_edge(timestamp, 0);
+
+  if (transfer->cmd_bits == 16)
+  {
+    this->handle_octal_command(transfer->cmd);
+  }
+  else if (transfer->cmd_bits)
+  {
+    this->current_cmd = transfer->cmd;
+    this->handle_command(this->current_cmd);
+  }
+
+  if (transfer->addr_bits && this->state == STATE_GET_ADDRESS)
+  {
+    this->current_addr = transfer->addr;
+    this->handle_address(timestamp);
+  }
+
+  // The dummy cycles are provided by the master as part of the header
+  if (this->state == STATE_WAIT_CYCLES)
+  {
+    this->wait_cycles = 0;
+    this->state = STATE_GET_DATA;
+    this->start_phase();
+  }
+
+  int64_t byte_timestamp = timestamp + transfer->get_header_cycles() * transfer->period;
+  int64_t byte_duration = transfer->period * 8 / transfer->data_lanes / (this->dtr ? 2 : 1);
+
+  for (int i=0; i<transfer->size; i++)
+  {
+    if (this->state == STATE_GET_DATA && this->is_read)
+    {
+      this->handle_read_byte(byte_timestamp);
+      transfer->data[i] = this->current_data;
+    }
+    else if (this->state == STATE_GET_DATA && this->is_write)
+    {
+      this->current_data = transfer->data[i];
+      this->handle_write_byte(byte_timestamp);
+    }
+    else if (!transfer->is_write)
+    {
+      // Nothing is driven, lines are pulled up
+      transfer->data[i] = 0xff;
+    }
+    byte_timestamp += byte_duration;
+  }
+
+  this->cs_edge(timestamp + transfer->get_duration(), 1);
+
+  return 0;
+}
+
+void Spiflash::handle_clk_high(int64_t timestamp, int lanes)
+{
+  if (this->state == STATE_WAIT_CYCLES)
   {
     this->trace_msg(this->trace, 3, "Wait cycle (cycles: %d)", this->wait_cycles);
     this->wait_cycles--;
     if (this->wait_cycles == 0)
     {
       this->state = STATE_GET_DATA;
+      this->start_phase();
     }
+    return;
   }
-  else if (this->state == STATE_GET_DATA)
+
+  this->sample(timestamp, lanes);
+}
+
+void Spiflash::sample(int64_t timestamp, int lanes)
+{
+  if (this->state != STATE_GET_CMD && this->state != STATE_GET_ADDRESS && (this->state != STATE_GET_DATA || !this->is_write))
+    return;
+
+  this->trace_msg(this->trace, 4, "Received bits (state: %d, count: %d, lanes: 0x%x)", this->state, this->rx.get_count(), lanes);
+
+  if (!this->rx.push(lanes))
+    return;
+
+  if (this->state == STATE_GET_CMD)
   {
-    if (this->is_write)
+    if (this->opi)
     {
-      if (this->qpi | this->quad_command)
-      {
-        this->current_data = (this->current_data << 4) | (sdio0 << 0) | (sdio1 << 1) | (sdio2 << 2) | (sdio3 << 3);
-        this->trace_msg(this->trace, 4, "Received data bits (count: %d, pending: %x, bit0: %d, bit1: %d, bit2: %d, bit3: %d)", this->cmd_count, this->current_data, sdio0, sdio1, sdio2, sdio3);
-        this->cmd_count += 4;
-      }
-      else
-      {
-        this->current_data = (this->current_data << 1) | sdio0;
-        this->trace_msg(this->trace, 4, "Received data bit (count: %d, pending: %x, bit: %d)", this->cmd_count, this->current_data, sdio0);
-        this->cmd_count++;
-      }
-      if (this->cmd_count == 8)
-      {
-        this->cmd_count = 0;
-        if(this->wren)
-        {
-          if (this->reg)
-          {
-            this->handle_reg_access(this->reg, timestamp);
-            this->state = STATE_WAIT_CS_EDGE;
-          }
-          else if (this->current_addr >= this->mem_size)
-          {
-            this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
-            this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)\n", this->current_addr, this->mem_size);
-          }
-          else
-          {
-            this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
-            if ((this->timestamp_busy + this->busy_time) > timestamp)
-            {
-              this->fatal("Trying to write while flash is busy");
-            }
-            else
-            {
-              if (!((~this->data[this->current_addr] & ~this->current_data) == ~this->data[this->current_addr]))
-              {
-                this->fatal("Trying to write non erased data at 0x%x 0x%2.2x original data:0x%2.2x\n", this->current_addr ,this->current_data,this->data[this->current_addr]);
-              }
-              this->data[this->current_addr++] = this->current_data;
-              if(this->current_addr >= (this->current_write_page + this->page_size))
-              {
-                this->current_addr = this->current_addr = this->current_write_page;
-              }
-            }
-          }
-        }
-      }
+      this->handle_octal_command(this->rx.get());
+    }
+    else
+    {
+      this->current_cmd = this->rx.get();
+      this->handle_command(this->current_cmd);
     }
   }
+  else if (this->state == STATE_GET_ADDRESS)
+  {
+    this->current_addr = this->rx.get();
+    this->handle_address(timestamp);
+  }
+  else
+  {
+    this->current_data = this->rx.get();
+    this->handle_write_byte(timestamp);
+  }
 }
 
-void Spiflash::handle_clk_low(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask)
+void Spiflash::handle_clk_low(int64_t timestamp)
 {
   if (this->state == STATE_GET_DATA && this->is_read)
   {
-    if (this->cmd_count == 0)
+    int lanes;
+
+    if (this->reg)
     {
-      if (this->reg)
+      if (this->tx.need_load())
       {
-        this->handle_reg_access(this->reg, timestamp);
+        this->handle_read_byte(timestamp);
+        this->tx.load(this->current_data);
       }
-      else if (this->current_addr >= this->mem_size)
-      {
-        this->fatal("Trying to read outside memory range (addr: 0x%x, mem size: 0x%x)\n", this->current_addr, this->mem_size);
-      }
-      else
-      {
-        this->current_data = this->data[this->current_addr];
-        this->trace_msg(this->trace, 2, "Read byte from memory (address: 0x%6.6x, value: 0x%2.2x)", this->current_addr, this->current_data);
-        this->current_addr++;
-      }
-    }
 
-    if (this->qpi || this->quad_command)
-    {
-      int bits = (this->current_data >> 4) & 0xf;
-      this->current_data <<= 4;
-      this->qspi0->set_qpi_data((bits >> 0) & 1, (bits >> 1) & 1, (bits >> 2) & 1, (bits >> 3) & 1, 0xf);
-      this->cmd_count += 4;
+      lanes = this->tx.pop();
     }
     else
     {
-      int bit = (this->current_data >> 7) & 1;
-      this->current_data <<= 1;
-      this->qspi0->set_data(bit);
-      this->cmd_count++;
-    }
+      if (this->read_burst.empty())
+        this->load_read_burst();
 
-    if (this->cmd_count == 8)
-    {
-      this->cmd_count = 0;
+      lanes = this->read_burst.pop();
     }
+
+    if (this->tx.get_nb_lanes() == 8)
+      this->qspi0->set_octal_data(lanes, 0xff);
+    else if (this->tx.get_nb_lanes() == 4)
+      this->qspi0->set_qpi_data((lanes >> 0) & 1, (lanes >> 1) & 1, (lanes >> 2) & 1, (lanes >> 3) & 1, 0xf);
+    else
+      this->qspi0->set_data(lanes);
   }
 }
 
@@ -689,18 +1442,62 @@ void Spiflash::sck_edge(int64_t timestamp, int sck, int sdio0, int sdio1, int sd
 {
   this->trace_msg(this->trace, 4, "SCK edge (timestamp: %ld, sck: %d, data_0: %d, data_1: %d, data_2: %d, data_3: %d, mask: 0x%x)", timestamp, sck, sdio0, sdio1, sdio2, sdio3, mask);
 
+  this->handle_sck_edge(timestamp, sck, Dpi_spi_shifter::pack(sdio0, sdio1, sdio2, sdio3));
+}
+
+void Spiflash::octal_sck_edge(int64_t timestamp, int sck, int data, int mask)
+{
+  this->trace_msg(this->trace, 4, "SCK edge (timestamp: %ld, sck: %d, data: 0x%2.2x, mask: 0x%x)", timestamp, sck, data, mask);
+
+  this->handle_sck_edge(timestamp, sck, data);
+}
+
+// Data is sampled on rising edges and driven on falling edges, except in
+// double transfer rate phases where both are done on both edges. Dummy
+// cycles are counted at the end of the cycle, i.e. on rising edges, or on
+// falling edges in double transfer rate phases.
+void Spiflash::handle_sck_edge(int64_t timestamp, int sck, int lanes)
+{
+  // The first data is driven on the edge following the end of the previous
+  // phase
+  bool reading = this->state == STATE_GET_DATA && this->is_read;
+
   if (prev_sck == 1 && !sck)
   {
-    handle_clk_low(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
+    if (this->dtr)
+      this->handle_clk_high(timestamp, lanes);
+    if (reading)
+      this->handle_clk_low(timestamp);
   }
   else if (prev_sck == 0 && sck)
   {
-    handle_clk_high(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
+    if (this->dtr)
+    {
+      this->sample(timestamp, lanes);
+      if (reading)
+        this->handle_clk_low(timestamp);
+    }
+    else
+    {
+      this->handle_clk_high(timestamp, lanes);
+    }
   }
   prev_sck = sck;
 }
 
 extern "C" Dpi_model *dpi_model_new(js::config *config, void *handle)
 {
-  return new Spiflash(config, handle);
+  return new Spiflash(config, handle, new Spiflash_images());
+}
+
+extern "C" int dpi_model_new_many(int nb_models, js::config **configs, void **handles, Dpi_model **models)
+{
+  Spiflash_images *images = new Spiflash_images();
+
+  for (int i=0; i<nb_models; i++)
+  {
+    models[i] = new Spiflash(configs[i], handles[i], images);
+  }
+
+  return 0;
 }
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include "dpi/models.hpp"
+#include "dpi/mem.hpp"
+#include "../ram_model.hpp"
+#include <stdint.h>
+#include <algorithm>
+
+/*
+ * HyperRAM model
+ *
+ * A transaction starts with the 48 bits command-address word, sent MSB first
+ * in 6 bytes over 3 clock cycles:
+ * - bit 47: 1 for reads, 0 for writes
+ * - bit 46: 1 for the register space, 0 for the memory
+ * - bit 45: 1 for linear bursts, 0 for wrapped bursts
+ * - bits 44 to 16 and 2 to 0: address of the first 16 bits word
+ * It is followed by the latency, counted in clock cycles after the
+ * command-address, and by the data, 2 bytes per clock cycle. Register writes
+ * have no latency. The latency is doubled when RWDS is high during the
+ * command-address, which is always the case with fixed latency.
+ *
+ * The memory is seen as an array of bytes, the byte transferred on the rising
+ * edge of each word being at the even address.
+ *
+ * Options, in addition to the ones of Ram_model:
+ * - latency: initial latency in clock cycles (3 to 7), default 6
+ * - fixed_latency: true to always double the latency, default true
+ */
+
+#define HYPERRAM_REG_ID0 0x0
+#define HYPERRAM_REG_ID1 0x1
+#define HYPERRAM_REG_CR0 0x800
+#define HYPERRAM_REG_CR1 0x801
+
+typedef enum {
+  HYPERRAM_STATE_IDLE,
+  HYPERRAM_STATE_CMD_ADDR,
+  HYPERRAM_STATE_LATENCY,
+  HYPERRAM_STATE_DATA
+} Hyperram_state_e;
+
+
+
+class Hyperram;
+
+class Hyperram_itf : public Hyper_itf
+{
+public:
+  Hyperram_itf(Hyperram *top) : top(top) {}
+  void cs_edge(int64_t timestamp, int cs);
+  void ck_edge(int64_t timestamp, int ck, int rwds, int data, int mask);
+  void edge(int64_t timestamp, int rwds, int data, int mask);
+  int transfer(int64_t timestamp, Hyper_transfer *transfer);
+
+private:
+  Hyperram *top;
+};
+
+
+
+class Hyperram : public Ram_model
+{
+  friend class Hyperram_itf;
+
+public:
+  Hyperram(js::config *config, void *handle);
+
+protected:
+  void cs_edge(int64_t timestamp, int cs);
+  void ck_edge(int64_t timestamp, int ck, int rwds, int data, int mask);
+  void edge(int64_t timestamp, int rwds, int data, int mask);
+  int transfer(int64_t timestamp, Hyper_transfer *transfer);
+
+private:
+  void handle_beat(int64_t timestamp, int rwds, int data);
+  void handle_cmd_addr();
+  void handle_read_byte(uint8_t *data);
+  void handle_write_byte(uint8_t data, int masked);
+  int burst_chunk(int size);
+  void burst_advance(int size);
+  uint16_t reg_read(uint32_t addr);
+  void reg_write(uint32_t addr, uint16_t value);
+  int get_latency() { return (((this->cr0 >> 4) & 0xf) + 5) & 0xf; }
+  bool is_fixed_latency() { return (this->cr0 >> 3) & 1; }
+
+  Hyperram_itf *hyper0;
+  void *trace;
+
+  Hyperram_state_e state = HYPERRAM_STATE_IDLE;
+  int current_cs = 1;
+  int prev_ck = 0;
+
+  uint64_t cmd_addr;
+  int cmd_addr_count;
+  int latency_beats;
+  // Number of data bytes already transferred in the current transaction
+  int data_count;
+
+  bool is_read;
+  bool is_reg;
+  uint32_t current_addr;
+  // Size of the wrapped group, or 0 for linear bursts
+  uint32_t wrap_size;
+  // In hybrid mode, number of bytes before the burst continues linearly
+  // after the wrapped group
+  uint32_t wrap_remaining;
+  uint16_t reg_value;
+
+  uint16_t id0 = 0x0c81;
+  uint16_t id1 = 0x0001;
+  uint16_t cr0 = 0x8f1f;
+  uint16_t cr1 = 0xffc1;
+};
+
+
+
+Hyperram::Hyperram(js::config *config, void *handle) : Ram_model(config, handle, 4*1000*1000)
+{
+  print("Creating HYPERRAM model (mem_size: 0x%x)", this->mem_size);
+
+  this->hyper0 = new Hyperram_itf(this);
+  this->create_itf("input", static_cast<Dpi_itf *>(this->hyper0));
+
+  js::config *latency_conf = config->get("latency");
+  if (latency_conf != NULL)
+  {
+    int latency = latency_conf->get_int();
+    if (latency < 3 || latency > 7)
+      this->fatal("Invalid latency (latency: %d)", latency);
+    else
+      this->cr0 = (this->cr0 & ~0xf0) | (((latency - 5) & 0xf) << 4);
+  }
+
+  js::config *fixed_conf = config->get("fixed_latency");
+  if (fixed_conf != NULL && !fixed_conf->get_bool())
+    this->cr0 &= ~(1 << 3);
+
+  this->trace = this->trace_new(config->get_child_str("name").c_str());
+}
+
+
+
+void Hyperram_itf::cs_edge(int64_t timestamp, int cs)
+{
+  top->cs_edge(timestamp, cs);
+}
+
+void Hyperram_itf::ck_edge(int64_t timestamp, int ck, int rwds, int data, int mask)
+{
+  top->ck_edge(timestamp, ck, rwds, data, mask);
+}
+
+void Hyperram_itf::edge(int64_t timestamp, int rwds, int data, int mask)
+{
+  top->edge(timestamp, rwds, data, mask);
+}
+
+int Hyperram_itf::transfer(int64_t timestamp, Hyper_transfer *transfer)
+{
+  return top->transfer(timestamp, transfer);
+}
+
+
+
+uint16_t Hyperram::reg_read(uint32_t addr)
+{
+  switch (addr)
+  {
+    case HYPERRAM_REG_ID0: return this->id0;
+    case HYPERRAM_REG_ID1: return this->id1;
+    case HYPERRAM_REG_CR0: return this->cr0;
+    case HYPERRAM_REG_CR1: return this->cr1;
+  }
+
+  print("WARNING: reading invalid register (addr: 0x%x)", addr);
+  return 0;
+}
+
+void Hyperram::reg_write(uint32_t addr, uint16_t value)
+{
+  this->trace_msg(this->trace, 2, "Writing register (addr: 0x%x, value: 0x%4.4x)", addr, value);
+
+  switch (addr)
+  {
+    case HYPERRAM_REG_CR0: this->cr0 = value; return;
+    case HYPERRAM_REG_CR1: this->cr1 = value; return;
+  }
+
+  print("WARNING: writing invalid register (addr: 0x%x)", addr);
+}
+
+void Hyperram::handle_cmd_addr()
+{
+  uint64_t ca = this->cmd_addr;
+
+  this->is_read = (ca >> 47) & 1;
+  this->is_reg = (ca >> 46) & 1;
+  bool linear = (ca >> 45) & 1;
+  uint32_t word_addr = (((ca >> 16) & 0x1fffffff) << 3) | (ca & 0x7);
+
+  this->current_addr = this->is_reg ? word_addr : word_addr * 2;
+  this->data_count = 0;
+
+  if (linear || this->is_reg)
+  {
+    this->wrap_size = 0;
+  }
+  else
+  {
+    static const uint32_t wrap_sizes[] = { 128, 64, 16, 32 };
+    this->wrap_size = wrap_sizes[this->cr0 & 0x3];
+    // Hybrid mode is enabled when bit 2 is 0
+    this->wrap_remaining = (this->cr0 >> 2) & 1 ? 0 : this->wrap_size;
+  }
+
+  if (this->is_reg && !this->is_read)
+    this->latency_beats = 0;
+  else
+    this->latency_beats = this->get_latency() * (this->is_fixed_latency() ? 2 : 1) * 2;
+
+  this->hyper0->stats_command(ca >> 40);
+
+  this->trace_msg(this->trace, 2, "Received command-address (value: 0x%12.12lx, read: %d, reg: %d, linear: %d, addr: 0x%x, latency: %d)",
+    ca, this->is_read, this->is_reg, linear, this->current_addr, this->latency_beats / 2);
+
+  this->state = this->latency_beats ? HYPERRAM_STATE_LATENCY : HYPERRAM_STATE_DATA;
+}
+
+// Number of contiguous bytes which can be accessed from the current address
+int Hyperram::burst_chunk(int size)
+{
+  if (this->wrap_size)
+  {
+    size = std::min(size, (int)(this->wrap_size - (this->current_addr & (this->wrap_size - 1))));
+    if (this->wrap_remaining)
+      size = std::min(size, (int)this->wrap_remaining);
+  }
+  return size;
+}
+
+void Hyperram::burst_advance(int size)
+{
+  this->current_addr += size;
+  this->data_count += size;
+
+  if (this->wrap_size)
+  {
+    if ((this->current_addr & (this->wrap_size - 1)) == 0)
+      this->current_addr -= this->wrap_size;
+
+    // In hybrid mode, once the whole group has been accessed, the burst
+    // continues linearly from the next group
+    if (this->wrap_remaining)
+    {
+      this->wrap_remaining -= size;
+      if (this->wrap_remaining == 0)
+      {
+        this->current_addr = (this->current_addr & ~(this->wrap_size - 1)) + this->wrap_size;
+        this->wrap_size = 0;
+      }
+    }
+  }
+}
+
+void Hyperram::handle_read_byte(uint8_t *data)
+{
+  if (this->is_reg)
+  {
+    if (this->data_count == 0)
+      this->reg_value = this->reg_read(this->current_addr);
+    *data = this->data_count & 1 ? this->reg_value : this->reg_value >> 8;
+    this->data_count++;
+    return;
+  }
+
+  if (this->current_addr >= (uint32_t)this->mem_size)
+  {
+    this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)", this->current_addr, this->mem_size);
+    *data = 0xff;
+    return;
+  }
+
+  *data = this->mem->read(this->current_addr);
+
+  this->trace_msg(this->trace, 4, "Read byte (addr: 0x%x, value: 0x%2.2x)", this->current_addr, *data);
+
+  this->burst_advance(1);
+}
+
+void Hyperram::handle_write_byte(uint8_t data, int masked)
+{
+  if (this->is_reg)
+  {
+    this->reg_value = (this->reg_value << 8) | data;
+    if (++this->data_count == 2)
+      this->reg_write(this->current_addr, this->reg_value);
+    return;
+  }
+
+  if (this->current_addr >= (uint32_t)this->mem_size)
+  {
+    this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)", this->current_addr, this->mem_size);
+    return;
+  }
+
+  this->trace_msg(this->trace, 4, "Write byte (addr: 0x%x, value: 0x%2.2x, masked: %d)", this->current_addr, data, masked);
+
+  // RWDS is the byte mask during writes
+  if (!masked)
+    this->mem->write(this->current_addr, data);
+
+  this->burst_advance(1);
+}
+
+void Hyperram::handle_beat(int64_t timestamp, int rwds, int data)
+{
+  switch (this->state)
+  {
+    case HYPERRAM_STATE_CMD_ADDR:
+      this->cmd_addr = (this->cmd_addr << 8) | (data & 0xff);
+      if (++this->cmd_addr_count == 6)
+        this->handle_cmd_addr();
+      break;
+
+    case HYPERRAM_STATE_LATENCY:
+      if (--this->latency_beats == 0)
+        this->state = HYPERRAM_STATE_DATA;
+      break;
+
+    case HYPERRAM_STATE_DATA:
+      if (this->is_read)
+      {
+        // RWDS is the read strobe, high for the first byte of each word
+        int strobe = (this->data_count & 1) == 0;
+        uint8_t value;
+        this->handle_read_byte(&value);
+        this->hyper0->set_data(strobe, value, 0xff);
+      }
+      else
+      {
+        this->handle_write_byte(data, rwds);
+      }
+      this->hyper0->stats_bytes(1);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void Hyperram::cs_edge(int64_t timestamp, int cs)
+{
+  if (this->current_cs == cs) return;
+
+  this->current_cs = cs;
+
+  this->trace_msg(this->trace, 3, "CS edge (timestamp: %ld, cs: %d)", timestamp, cs);
+
+  if (cs == 0)
+  {
+    this->refresh_arm(timestamp);
+    this->state = HYPERRAM_STATE_CMD_ADDR;
+    this->cmd_addr = 0;
+    this->cmd_addr_count = 0;
+    // RWDS tells the master during the command-address whether the latency
+    // is doubled
+    this->hyper0->set_data(this->is_fixed_latency(), 0, 0);
+  }
+  else
+  {
+    this->refresh_disarm(timestamp);
+    this->state = HYPERRAM_STATE_IDLE;
+  }
+}
+
+void Hyperram::ck_edge(int64_t timestamp, int ck, int rwds, int data, int mask)
+{
+  // Data is transferred on both edges, so any clock change is a new byte
+  if (ck == this->prev_ck)
+    return;
+
+  this->prev_ck = ck;
+
+  if (this->refresh_failure)
+    return;
+
+  this->trace_msg(this->trace, 4, "CK edge (timestamp: %ld, ck: %d, rwds: %d, data: 0x%2.2x, mask: 0x%x)", timestamp, ck, rwds, data, mask);
+
+  this->handle_beat(timestamp, rwds, data);
+}
+
+void Hyperram::edge(int64_t timestamp, int rwds, int data, int mask)
+{
+  if (this->refresh_failure)
+    return;
+
+  this->trace_msg(this->trace, 4, "Edge (timestamp: %ld, rwds: %d, data: 0x%2.2x, mask: 0x%x)", timestamp, rwds, data, mask);
+
+  this->handle_beat(timestamp, rwds, data);
+}
+
+int Hyperram::transfer(int64_t timestamp, Hyper_transfer *transfer)
+{
+  this->trace_msg(this->trace, 3, "Transfer (timestamp: %ld, cmd_addr: 0x%12.12lx, size: %d)", timestamp, transfer->cmd_addr, transfer->size);
+
+  this->cmd_addr = transfer->cmd_addr;
+  this->handle_cmd_addr();
+
+  transfer->latency = this->latency_beats / 2;
+
+  // The whole transfer is handled at once, so the refresh constraint is
+  // checked here instead of with the timer
+  int64_t data_timestamp = timestamp + (3 + transfer->latency) * transfer->period;
+  int size = this->refresh_limit(timestamp, data_timestamp, transfer->period / 2, transfer->size);
+
+  if (this->is_reg)
+  {
+    for (int i=0; i<size; i++)
+    {
+      if (this->is_read)
+        this->handle_read_byte(&transfer->data[i]);
+      else
+        this->handle_write_byte(transfer->data[i], 0);
+    }
+  }
+  else
+  {
+    // Memory bursts are split into contiguous chunks, which are only broken
+    // by the wrap boundaries
+    int index = 0;
+    while (index < size)
+    {
+      int iter_size = this->burst_chunk(size - index);
+
+      if (!this->mem->check_range(this->current_addr, iter_size))
+      {
+        this->fatal("Received out-of-bound request (addr: 0x%x, size: 0x%x, ram_size: 0x%x)", this->current_addr, iter_size, this->mem_size);
+        break;
+      }
+
+      if (this->is_read)
+        this->mem->read_block(this->current_addr, &transfer->data[index], iter_size);
+      else
+        this->mem->write_block(this->current_addr, &transfer->data[index], iter_size);
+
+      this->burst_advance(iter_size);
+      index += iter_size;
+    }
+  }
+
+  this->hyper0->stats_bytes(size);
+
+  if (size < transfer->size)
+    this->refresh_failed();
+
+  this->refresh_failure = false;
+  this->state = HYPERRAM_STATE_IDLE;
+
+  return 0;
+}
+
+extern "C" Dpi_model *dpi_model_new(js::config *config, void *handle)
+{
+  return new Hyperram(config, handle);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include "ram_model.hpp"
+#include <algorithm>
+
+
+Ram_model::Ram_model(js::config *config, void *handle, int64_t cs_pulse_width)
+: Dpi_model(config, handle), cs_pulse_width(cs_pulse_width)
+{
+  this->mem_size = config->get("mem_size")->get_int();
+  this->mem = new Dpi_mem(this->mem_size);
+  this->set_backdoor_mem(this->mem);
+
+  js::config *pulse_conf = config->get("cs_pulse_width_ns");
+  if (pulse_conf != NULL)
+    this->cs_pulse_width = (int64_t)pulse_conf->get_int() * 1000;
+
+  if (this->mem->map_shm_from_config(config))
+    this->fatal("%s", this->mem->get_error().c_str());
+}
+
+void Ram_model::start()
+{
+  if (this->mem->preload_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
+}
+
+void Ram_model::stop()
+{
+  if (this->mem->dump_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
+}
+
+void Ram_model::refresh_arm(int64_t timestamp)
+{
+  this->cs_fall_timestamp = timestamp;
+
+  // The timer fires 1ps after the deadline so that CS rising exactly on it is
+  // not a violation, whatever the order of the events
+  int64_t delay = std::max(timestamp + this->cs_pulse_width + 1 - this->get_time(), (int64_t)0);
+  this->refresh_handler_id = this->create_delayed_handler(delay, (void *)&Ram_model::refresh_handler_stub, this);
+}
+
+void Ram_model::refresh_disarm(int64_t timestamp)
+{
+  if (this->refresh_handler_id != -1)
+  {
+    this->cancel_delayed_handler(this->refresh_handler_id);
+    this->refresh_handler_id = -1;
+  }
+
+  if (!this->refresh_failure && timestamp - this->cs_fall_timestamp > this->cs_pulse_width)
+    this->refresh_failed();
+
+  this->refresh_failure = false;
+}
+
+void Ram_model::refresh_handler_stub(Ram_model *_this)
+{
+  _this->refresh_handler_id = -1;
+  _this->refresh_failed();
+}
+
+void Ram_model::refresh_failed()
+{
+  this->fatal("CS has not been released in time to let the RAM being refreshed");
+  this->mem->invalidate();
+  this->refresh_failure = true;
+}
+
+int Ram_model::refresh_limit(int64_t cs_timestamp, int64_t data_timestamp, int64_t byte_duration, int size)
+{
+  int64_t limit = cs_timestamp + this->cs_pulse_width;
+
+  if (data_timestamp > limit)
+    return 0;
+
+  if (byte_duration && (limit - data_timestamp) / byte_duration + 1 < size)
+    return (limit - data_timestamp) / byte_duration + 1;
+
+  return size;
+}
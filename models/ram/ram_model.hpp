@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __RAM_MODEL_HPP__
+#define __RAM_MODEL_HPP__
+
+#include "dpi/models.hpp"
+#include "dpi/mem.hpp"
+#include <stdint.h>
+
+/*
+ * Common part of the self-refreshed RAM models (spiram, hyperram)
+ *
+ * Holds the memory content, with its preload and dump options, and checks the
+ * refresh constraint: the RAM is not refreshed while it is selected, so its
+ * content is lost if CS is kept low for more than cs_pulse_width.
+ * The models call refresh_arm() when CS falls and refresh_disarm() when it
+ * rises, and a timer reports the violation, so that the edges do not have to
+ * check anything but refresh_failure. As edges can be given with timestamps
+ * ahead of the simulation time (batched edges), the CS rise timestamp is also
+ * checked against the CS fall one, in case the timer could not fire before.
+ * CS can be kept low for exactly cs_pulse_width, it is a violation only if
+ * it stays low longer. Transaction-level accesses are handled in a single
+ * call and use refresh_limit() instead.
+ *
+ * Options:
+ * - mem_size: size of the memory in bytes
+ * - cs_pulse_width_ns: maximum time CS can be kept low, the default is given
+ *   by the model
+ * - preload_file, preload_format, preload_base: initial content
+ * - dump_file, dump_crc_file, dump_crc_region_size: content dumped at the end
+ *   of the simulation
+ */
+
+class Ram_model : public Dpi_model
+{
+public:
+  Ram_model(js::config *config, void *handle, int64_t cs_pulse_width);
+
+  void start();
+  void stop();
+
+protected:
+  // Called when CS falls and rises
+  void refresh_arm(int64_t timestamp);
+  void refresh_disarm(int64_t timestamp);
+
+  // Raise the refresh violation and lose the content. The edges are then
+  // ignored until CS is released.
+  void refresh_failed();
+
+  // Number of bytes of a transfer which can be handled before CS should have
+  // been released. cs_timestamp is the time CS fell, data_timestamp the time
+  // of the first byte.
+  int refresh_limit(int64_t cs_timestamp, int64_t data_timestamp, int64_t byte_duration, int size);
+
+  Dpi_mem *mem;
+  int mem_size;
+  bool refresh_failure = false;
+  // In ps
+  int64_t cs_pulse_width;
+
+private:
+  static void refresh_handler_stub(Ram_model *_this);
+
+  int64_t refresh_handler_id = -1;
+  int64_t cs_fall_timestamp = 0;
+};
+
+#endif
@@ -19,8 +19,12 @@
  */
 
 #include "dpi/models.hpp"
+#include "dpi/mem.hpp"
+#include "dpi/spi_shifter.hpp"
+#include "../ram_model.hpp"
 #include <stdint.h>
 #include <vector>
+#include <algorithm>
 
 
 typedef enum {
@@ -40,7 +44,10 @@ public:
   Spiram_qspi_itf(Spiram *top) : top(top) {}
   void sck_edge(int64_t timestamp, int sck, int data_0, int data_1, int data_2, int data_3, int mask);
   void edge(int64_t timestamp, int data_0, int data_1, int data_2, int data_3, int mask);
+  void octal_sck_edge(int64_t timestamp, int sck, int data, int mask);
+  void octal_edge(int64_t timestamp, int data, int mask);
   void cs_edge(int64_t timestamp, int cs);
+  int transfer(int64_t timestamp, Qspi_transfer *transfer);
 
 private:
     Spiram *top;
@@ -48,7 +55,7 @@ private:
 
 
 
-class Spiram : public Dpi_model
+class Spiram : public Ram_model
 {
   friend class Spiram_qspi_itf;
 
@@ -59,28 +66,44 @@ protected:
 
   void sck_edge(int64_t timestamp, int sck, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
   void edge(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
+  void octal_sck_edge(int64_t timestamp, int sck, int data, int mask);
+  void octal_edge(int64_t timestamp, int data, int mask);
   void cs_edge(int64_t timestamp, int cs);
-  void handle_clk_high(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
-  void handle_clk_low(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
+  int transfer(int64_t timestamp, Qspi_transfer *transfer);
+  void handle_sck_edge(int64_t timestamp, int sck, int lanes);
+  void handle_edge(int64_t timestamp, int lanes);
+  void handle_clk_high(int64_t timestamp, int lanes);
+  void handle_clk_low(int64_t timestamp);
+  void sample(int64_t timestamp, int lanes);
 
 
 private:
 
   void handle_command(uint8_t cmd);
-  bool check_refresh(int64_t timestamp);
+  void handle_octal_command(uint32_t value);
+  void start_phase();
+  void handle_address();
+  void handle_write_byte();
+  void handle_read_byte();
+  void load_read_burst();
+  void flush_read_burst();
+  void set_cs(int64_t timestamp, int cs);
 
   Spiram_qspi_itf *qspi0;
 
   Spiram_state_e state;
 
-  int cmd_count;
+  // Shifters for the lines sampled and driven by the RAM
+  Dpi_spi_shifter rx;
+  // Next edges of a read and number of lanes they are driven on
+  Dpi_spi_read_burst read_burst;
+  int read_lanes = 1;
   int prev_sck = 0;
   int dummy_cycles = 0;
   int command_addr;
   int current_write_addr;
   int current_size;
   int current_write_size;
-  unsigned char *data;
   int nb_bits;
   int nb_write_bits;
   uint32_t byte;
@@ -91,25 +114,29 @@ private:
   int tx_dump_bits;
   bool tx_dump_qpi;
   int tx_dump_byte;
-  int mem_size;
   uint8_t current_cmd;
   bool qpi;
   bool quad_command;
+  // Octal mode, where commands are 16 bits (the opcode sent twice) and all
+  // phases use 8 lanes, and octal DTR mode where everything is transferred
+  // on both edges
+  bool opi = false;
+  bool dopi = false;
+  // Half cycle of a phase in octal DTR mode with edge mode
+  int dtr_beat = 0;
+  // Latency of the octal linear burst commands
+  int read_latency = 5;
   uint32_t current_addr;
   uint8_t current_data;
   bool is_write;
   int wait_cycles;
-  int64_t refresh_timestamp;
-  bool refresh_failure;
-  int cs_pulse_width;
   void *trace;
   int cross_pagesize_limit_mask;
 };
 
 
-Spiram::Spiram(js::config *config, void *handle) : Dpi_model(config, handle)
+Spiram::Spiram(js::config *config, void *handle) : Ram_model(config, handle, 8*1000*1000)
 {
-  this->mem_size = config->get("mem_size")->get_int();
   verbose = true; //config->get("verbose")->get_bool();
   int cross_pagesize_limit = config->get("cross_page_size")->get_int();
 
@@ -124,24 +151,38 @@ Spiram::Spiram(js::config *config, void *handle) : Dpi_model(config, handle)
 
 
   print("Creating SPIRAM model (mem_size: 0x%x)", this->mem_size);
-  data = new unsigned char[mem_size];
   qspi0 = new Spiram_qspi_itf(this);
   create_itf("input", static_cast<Dpi_itf *>(qspi0));
 
   this->current_cs = 1;
   this->tx_file = NULL;
 
-  this->state = STATE_GET_CMD;
-  this->cmd_count = 0;
   this->qpi = false;
-  this->refresh_timestamp = -1;
-  this->refresh_failure = false;
-  this->cs_pulse_width = 8*1000*1000;
+
+  js::config *mode_conf = config->get("mode");
+  if (mode_conf != NULL)
+  {
+    std::string mode = mode_conf->get_str();
+    if (mode == "qpi")
+      this->qpi = true;
+    else if (mode == "opi")
+      this->opi = true;
+    else if (mode == "dopi")
+      this->opi = this->dopi = true;
+    else if (mode != "spi")
+      this->fatal("Unknown RAM mode (mode: %s)", mode.c_str());
+  }
+
+  js::config *latency_conf = config->get("read_latency");
+  if (latency_conf != NULL)
+    this->read_latency = latency_conf->get_int();
+
+  this->state = STATE_GET_CMD;
+  this->start_phase();
 
   this->trace = this->trace_new(config->get_child_str("name").c_str());
 }
 
-
 void Spiram_qspi_itf::cs_edge(int64_t timestamp, int cs)
 {
   top->cs_edge(timestamp, cs);
@@ -157,42 +198,37 @@ void Spiram_qspi_itf::edge(int64_t timestamp, int data_0, int data_1, int data_2
   top->edge(timestamp, data_0, data_1, data_2, data_3, mask);
 }
 
-bool Spiram::check_refresh(int64_t timestamp)
+void Spiram_qspi_itf::octal_sck_edge(int64_t timestamp, int sck, int data, int mask)
 {
-  if (this->refresh_failure)
-    return true;
+  top->octal_sck_edge(timestamp, sck, data, mask);
+}
 
-  if (this->refresh_timestamp != -1 && this->refresh_timestamp < timestamp)
-  {
-    this->fatal("CS has not been released in time to let the RAM being refreshed");
-    memset(this->data, 0, this->mem_size);
-    this->refresh_timestamp = -1;
-    this->refresh_failure = true;
-    return true;
-  }
+void Spiram_qspi_itf::octal_edge(int64_t timestamp, int data, int mask)
+{
+  top->octal_edge(timestamp, data, mask);
+}
 
-  return false;
+int Spiram_qspi_itf::transfer(int64_t timestamp, Qspi_transfer *transfer)
+{
+  return top->transfer(timestamp, transfer);
 }
 
 void Spiram::cs_edge(int64_t timestamp, int cs)
 {
+  if (this->current_cs == cs) return;
+
   if (cs == 0)
-  {
-    if (this->check_refresh(timestamp))
-      return;
-  }
+    this->refresh_arm(timestamp);
+  else
+    this->refresh_disarm(timestamp);
 
-  if (this->current_cs == cs) return;
+  this->set_cs(timestamp, cs);
+}
 
-  if (this->current_cs == 1 && cs == 0)
-  {
-    this->refresh_timestamp = timestamp + this->cs_pulse_width;
-  }
-  else if (cs == 1)
-  {
-    this->refresh_timestamp = -1;
+void Spiram::set_cs(int64_t timestamp, int cs)
+{
+  if (cs == 1)
     this->refresh_failure = false;
-  }
 
   this->current_cs = cs;
 
@@ -200,7 +236,7 @@ void Spiram::cs_edge(int64_t timestamp, int cs)
   if (cs == 1) {
     qspi0->set_data(3);
     this->state = STATE_GET_CMD;
-    this->cmd_count = 0;
+    this->start_phase();
   }
 
   if (cs == 0)
@@ -210,19 +246,45 @@ void Spiram::cs_edge(int64_t timestamp, int cs)
 
 void Spiram::edge(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask)
 {
-  if (this->check_refresh(timestamp))
+  if (this->refresh_failure)
     return;
 
   this->trace_msg(this->trace, 4, "Edge (timestamp: %ld, data_0: %d, data_1: %d, data_2: %d, data_3: %d, mask: 0x%x)", timestamp, sdio0, sdio1, sdio2, sdio3, mask);
 
-  handle_clk_high(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
-  handle_clk_low(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
+  this->handle_edge(timestamp, Dpi_spi_shifter::pack(sdio0, sdio1, sdio2, sdio3));
+}
+
+void Spiram::octal_edge(int64_t timestamp, int data, int mask)
+{
+  if (this->refresh_failure)
+    return;
+
+  this->trace_msg(this->trace, 4, "Edge (timestamp: %ld, data: 0x%2.2x, mask: 0x%x)", timestamp, data, mask);
+
+  this->handle_edge(timestamp, data);
+}
+
+// In edge mode, each call is a full cycle, except in octal DTR mode where it
+// is half a cycle, so that dummy cycles are then counted every 2 calls
+void Spiram::handle_edge(int64_t timestamp, int lanes)
+{
+  if (this->dopi && this->state == STATE_WAIT_CYCLES)
+  {
+    this->dtr_beat ^= 1;
+    if (this->dtr_beat)
+      return;
+  }
+
+  this->handle_clk_high(timestamp, lanes);
+  this->handle_clk_low(timestamp);
 }
 
 void Spiram::handle_command(uint8_t cmd)
 {
   this->trace_msg(this->trace, 2, "Handling command 0x%2.2x", this->current_cmd);
 
+  this->qspi0->stats_command(cmd);
+
   if (this->current_cmd == 0x35)
   {
     this->trace_msg(this->trace, 1, "Enabling QPI mode");
@@ -273,6 +335,22 @@ void Spiram::handle_command(uint8_t cmd)
     this->is_write = false;
     this->wait_cycles = 6;
   }
+  else if (this->current_cmd == 0x20)
+  {
+    this->trace_msg(this->trace, 1, "Octal linear burst read");
+    this->quad_command = false;
+    this->state = STATE_GET_ADDRESS;
+    this->is_write = false;
+    this->wait_cycles = this->read_latency;
+  }
+  else if (this->current_cmd == 0xA0)
+  {
+    this->trace_msg(this->trace, 1, "Octal linear burst write");
+    this->quad_command = false;
+    this->state = STATE_GET_ADDRESS;
+    this->is_write = true;
+    this->wait_cycles = this->read_latency;
+  }
   else if (this->current_cmd == 0x66)
   {
     this->trace_msg(this->trace, 1, "Reset enable");
@@ -281,167 +359,340 @@ void Spiram::handle_command(uint8_t cmd)
   {
     this->trace_msg(this->trace, 1, "Reset");
   }
+
+  this->start_phase();
 }
 
-void Spiram::handle_clk_high(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask)
+void Spiram::handle_octal_command(uint32_t value)
 {
-  if (this->state == STATE_GET_CMD)
+  uint8_t cmd = value >> 8;
+
+  if ((value & 0xff) != cmd)
   {
-    if (this->qpi)
+    this->fatal("Received invalid octal command (value: 0x%4.4x)", value);
+    return;
+  }
+
+  this->current_cmd = cmd;
+  this->handle_command(cmd);
+}
+
+// Prepare the shifters for the phase of the new state
+void Spiram::start_phase()
+{
+  this->flush_read_burst();
+  this->dtr_beat = 0;
+
+  int lanes = this->opi ? 8 : this->qpi ? 4 : 1;
+
+  switch (this->state)
+  {
+    case STATE_GET_CMD:
+      this->rx.start(this->opi ? 16 : 8, lanes);
+      break;
+
+    case STATE_GET_ADDRESS:
+      this->rx.start(this->opi ? 32 : 24, lanes);
+      break;
+
+    case STATE_GET_DATA:
+      this->rx.start(8, lanes);
+      this->read_lanes = this->quad_command ? std::max(lanes, 4) : lanes;
+      break;
+
+    default:
+      break;
+  }
+}
+
+void Spiram::handle_address()
+{
+  // Addresses are 4 bytes in octal mode
+  if (!this->opi)
+    this->current_addr = this->current_addr & 0xffffff;
+  this->trace_msg(this->trace, 2, "Received address (addr: 0x%6.6x)", this->current_addr);
+  if (this->wait_cycles)
+    this->state = STATE_WAIT_CYCLES;
+  else
+    this->state = STATE_GET_DATA;
+  this->start_phase();
+}
+
+void Spiram::handle_write_byte()
+{
+  this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
+
+  if (this->current_addr >= this->mem_size)
+  {
+    this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)\n", this->current_addr, this->mem_size);
+  }
+  else
+  {
+    this->mem->write(this->current_addr, this->current_data);
+    this->qspi0->stats_bytes(1);
+    if (this->cross_pagesize_limit_mask)
     {
-      this->current_cmd = (this->current_cmd << 4) | (sdio0 << 0) | (sdio1 << 1) | (sdio2 << 2) | (sdio3 << 3);
-      this->trace_msg(this->trace, 4, "Received command bits (count: %d, pending: %x, bit0: %d, bit1: %d, bit2: %d, bit3: %d)", this->cmd_count, this->current_cmd, sdio0, sdio1, sdio2, sdio3);
-      this->cmd_count += 4;
+      this->current_addr = (this->current_addr & this->cross_pagesize_limit_mask) | ((this->current_addr + 1) & ~this->cross_pagesize_limit_mask);
     }
     else
     {
-      this->current_cmd = (this->current_cmd << 1) | sdio0;
-      this->trace_msg(this->trace, 4, "Received command bit (count: %d, pending: %x, bit: %d)", this->cmd_count, this->current_cmd, sdio0);
-      this->cmd_count++;
-    }
-    if (this->cmd_count == 8)
-    {
-      this->cmd_count = 0;
-      this->handle_command(this->current_cmd);
+      this->current_addr++;
     }
   }
-  else if (this->state == STATE_GET_ADDRESS)
+}
+
+void Spiram::handle_read_byte()
+{
+  if (this->current_addr >= this->mem_size)
+  {
+    //this->fatal("Trying to read outside memory range (addr: 0x%x, mem size: 0x%x)\n", this->current_addr, this->mem_size);
+  }
+  else
   {
-    if (this->qpi)
+    this->current_data = this->mem->read(this->current_addr);
+    this->trace_msg(this->trace, 2, "Read byte from memory (address: 0x%6.6x, value: 0x%2.2x)", this->current_addr, this->current_data);
+    this->qspi0->stats_bytes(1);
+    if (this->cross_pagesize_limit_mask)
     {
-      this->current_addr = (this->current_addr << 4) | (sdio0 << 0) | (sdio1 << 1) | (sdio2 << 2) | (sdio3 << 3);
-      this->trace_msg(this->trace, 4, "Received address bits (count: %d, pending: %x, bit0: %d, bit1: %d, bit2: %d, bit3: %d)", this->cmd_count, this->current_addr, sdio0, sdio1, sdio2, sdio3);
-      this->cmd_count += 4;
+      this->current_addr = (this->current_addr & this->cross_pagesize_limit_mask) | ((this->current_addr + 1) & ~this->cross_pagesize_limit_mask);
     }
     else
     {
-      this->current_addr = (this->current_addr << 1) | sdio0;
-      this->trace_msg(this->trace, 4, "Received address bit (count: %d, pending: %x, bit: %d)", this->cmd_count, this->current_addr, sdio0);
-      this->cmd_count++;
-    }
-    if (this->cmd_count == 24)
-    {
-      this->cmd_count = 0;
-      this->current_addr = this->current_addr & 0xffffff;
-      this->trace_msg(this->trace, 2, "Received address (addr: 0x%6.6x)", this->current_addr);
-      if (this->wait_cycles)
-        this->state = STATE_WAIT_CYCLES;
-      else
-        this->state = STATE_GET_DATA;
+      this->current_addr++;
     }
   }
-  else if (this->state == STATE_WAIT_CYCLES)
+}
+
+void Spiram::load_read_burst()
+{
+  this->flush_read_burst();
+
+  uint8_t *buffer = this->read_burst.get_buffer();
+  int size = 1;
+
+  if (this->current_addr >= this->mem_size)
+  {
+    buffer[0] = this->current_data;
+  }
+  else
   {
-    this->trace_msg(this->trace, 3, "Wait cycle (cycles: %d)", this->wait_cycles);
-    this->wait_cycles--;
-    if (this->wait_cycles == 0)
+    // The burst stops at the end of the memory and at the page boundary
+    // where the address wraps, so that the range is checked once
+    size = std::min(DPI_SPI_READ_BURST_SIZE, this->mem_size - (int)this->current_addr);
+    if (this->cross_pagesize_limit_mask)
+      size = std::min(size, (int)(~this->cross_pagesize_limit_mask - (this->current_addr & ~this->cross_pagesize_limit_mask) + 1));
+
+    this->mem->read_block(this->current_addr, buffer, size);
+    this->trace_msg(this->trace, 2, "Read burst from memory (address: 0x%6.6x, size: %d)", this->current_addr, size);
+    this->current_data = buffer[size - 1];
+
+    if (this->cross_pagesize_limit_mask)
     {
-      this->state = STATE_GET_DATA;
+      this->current_addr = (this->current_addr & this->cross_pagesize_limit_mask) | ((this->current_addr + size) & ~this->cross_pagesize_limit_mask);
+    }
+    else
+    {
+      this->current_addr += size;
     }
   }
-  else if (this->state == STATE_GET_DATA)
+
+  this->read_burst.load(size, this->read_lanes);
+}
+
+// Account the bytes of the current burst which have been sent and drop the
+// others
+void Spiram::flush_read_burst()
+{
+  int nb_bytes = this->read_burst.get_started_bytes();
+  if (nb_bytes)
+    this->qspi0->stats_bytes(nb_bytes);
+  this->read_burst.reset();
+}
+
+int Spiram::transfer(int64_t timestamp, Qspi_transfer *transfer)
+{
+  this->trace_msg(this->trace, 3, "Transfer (timestamp: %ld, cmd: 0x%lx, addr: 0x%lx, is_write: %d, size: %d)", timestamp, transfer->cmd, transfer->addr, transfer->is_write, transfer->size);
+
+  this->set_cs(timestamp, 0);
+
+  if (transfer->cmd_bits == 16)
+  {
+    this->handle_octal_command(transfer->cmd);
+  }
+  else if (transfer->cmd_bits)
+  {
+    this->current_cmd = transfer->cmd;
+    this->handle_command(this->current_cmd);
+  }
+
+  if (transfer->addr_bits && this->state == STATE_GET_ADDRESS)
   {
-    if (this->is_write)
+    this->current_addr = transfer->addr;
+    this->handle_address();
+  }
+
+  // The dummy cycles are provided by the master as part of the header
+  if (this->state == STATE_WAIT_CYCLES)
+  {
+    this->wait_cycles = 0;
+    this->state = STATE_GET_DATA;
+    this->start_phase();
+  }
+
+  int64_t byte_timestamp = timestamp + transfer->get_header_cycles() * transfer->period;
+  int64_t byte_duration = transfer->period * 8 / transfer->data_lanes / (this->dopi ? 2 : 1);
+
+  // The whole transfer is handled at once, so the refresh constraint is
+  // checked here instead of with the timer
+  int size = this->refresh_limit(timestamp, byte_timestamp, byte_duration, transfer->size);
+
+  for (int i=0; i<size; i++)
+  {
+    if (this->state == STATE_GET_DATA)
     {
-      if (this->qpi)
+      if (this->is_write)
       {
-        this->current_data = (this->current_data << 4) | (sdio0 << 0) | (sdio1 << 1) | (sdio2 << 2) | (sdio3 << 3);
-        this->trace_msg(this->trace, 4, "Received data bits (count: %d, pending: %x, bit0: %d, bit1: %d, bit2: %d, bit3: %d)", this->cmd_count, this->current_data, sdio0, sdio1, sdio2, sdio3);
-        this->cmd_count += 4;
+        this->current_data = transfer->data[i];
+        this->handle_write_byte();
       }
       else
       {
-        this->current_data = (this->current_data << 1) | sdio0;
-        this->trace_msg(this->trace, 4, "Received data bit (count: %d, pending: %x, bit: %d)", this->cmd_count, this->current_data, sdio0);
-        this->cmd_count++;
-      }
-      if (this->cmd_count == 8)
-      {
-        this->cmd_count = 0;
-        this->trace_msg(this->trace, 2, "Writing data (addr: 0x%x, value: 0x%2.2x)", this->current_addr, this->current_data);
-
-        if (this->current_addr >= this->mem_size)
-        {
-          this->fatal("Received out-of-bound request (addr: 0x%x, ram_size: 0x%x)\n", this->current_addr, this->mem_size);
-        }
-        else
-        {
-          this->data[this->current_addr] = this->current_data;
-          if (this->cross_pagesize_limit_mask)
-          {
-            this->current_addr = (this->current_addr & this->cross_pagesize_limit_mask) | ((this->current_addr + 1) & ~this->cross_pagesize_limit_mask);
-          }
-          else
-          {
-            this->current_addr++;
-          }
-        }
+        this->handle_read_byte();
+        transfer->data[i] = this->current_data;
       }
     }
+    else if (!transfer->is_write)
+    {
+      transfer->data[i] = 0xff;
+    }
   }
+
+  if (size < transfer->size)
+    this->refresh_failed();
+
+  this->set_cs(timestamp + transfer->get_duration(), 1);
+
+  return 0;
 }
 
-void Spiram::handle_clk_low(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask)
+void Spiram::handle_clk_high(int64_t timestamp, int lanes)
 {
-  if (this->state == STATE_GET_DATA && !this->is_write)
+  if (this->state == STATE_WAIT_CYCLES)
   {
-    if (this->cmd_count == 0)
+    this->trace_msg(this->trace, 3, "Wait cycle (cycles: %d)", this->wait_cycles);
+    this->wait_cycles--;
+    if (this->wait_cycles == 0)
     {
-      if (this->current_addr >= this->mem_size)
-      {
-        //this->fatal("Trying to read outside memory range (addr: 0x%x, mem size: 0x%x)\n", this->current_addr, this->mem_size);
-      }
-      else
-      {
-        this->current_data = this->data[this->current_addr];
-        this->trace_msg(this->trace, 2, "Read byte from memory (address: 0x%6.6x, value: 0x%2.2x)", this->current_addr, this->current_data);
-        if (this->cross_pagesize_limit_mask)
-        {
-          this->current_addr = (this->current_addr & this->cross_pagesize_limit_mask) | ((this->current_addr + 1) & ~this->cross_pagesize_limit_mask);
-        }
-        else
-        {
-          this->current_addr++;
-        }
-      }
+      this->state = STATE_GET_DATA;
+      this->start_phase();
     }
+    return;
+  }
+
+  this->sample(timestamp, lanes);
+}
+
+void Spiram::sample(int64_t timestamp, int lanes)
+{
+  if (this->state == STATE_WAIT_CYCLES || (this->state == STATE_GET_DATA && !this->is_write))
+    return;
+
+  this->trace_msg(this->trace, 4, "Received bits (state: %d, count: %d, lanes: 0x%x)", this->state, this->rx.get_count(), lanes);
+
+  if (!this->rx.push(lanes))
+    return;
 
-    if (this->qpi || this->quad_command)
+  if (this->state == STATE_GET_CMD)
+  {
+    if (this->opi)
     {
-      int bits = (this->current_data >> 4) & 0xf;
-      this->current_data <<= 4;
-      this->qspi0->set_qpi_data((bits >> 0) & 1, (bits >> 1) & 1, (bits >> 2) & 1, (bits >> 3) & 1, 0xf);
-      this->cmd_count += 4;
+      this->handle_octal_command(this->rx.get());
     }
     else
     {
-      int bit = (this->current_data >> 7) & 1;
-      this->current_data <<= 1;
-      this->qspi0->set_data(bit);
-      this->cmd_count++;
+      this->current_cmd = this->rx.get();
+      this->handle_command(this->current_cmd);
     }
+  }
+  else if (this->state == STATE_GET_ADDRESS)
+  {
+    this->current_addr = this->rx.get();
+    this->handle_address();
+  }
+  else
+  {
+    this->current_data = this->rx.get();
+    this->handle_write_byte();
+  }
+}
 
-    if (this->cmd_count == 8)
-    {
-      this->cmd_count = 0;
-    }
+void Spiram::handle_clk_low(int64_t timestamp)
+{
+  if (this->state == STATE_GET_DATA && !this->is_write)
+  {
+    if (this->read_burst.empty())
+      this->load_read_burst();
+
+    int lanes = this->read_burst.pop();
+
+    if (this->read_lanes == 8)
+      this->qspi0->set_octal_data(lanes, 0xff);
+    else if (this->read_lanes == 4)
+      this->qspi0->set_qpi_data((lanes >> 0) & 1, (lanes >> 1) & 1, (lanes >> 2) & 1, (lanes >> 3) & 1, 0xf);
+    else
+      this->qspi0->set_data(lanes);
   }
 }
 
 void Spiram::sck_edge(int64_t timestamp, int sck, int sdio0, int sdio1, int sdio2, int sdio3, int mask)
 {
-  if (this->check_refresh(timestamp))
+  if (this->refresh_failure)
     return;
 
   this->trace_msg(this->trace, 4, "SCK edge (timestamp: %ld, sck: %d, data_0: %d, data_1: %d, data_2: %d, data_3: %d, mask: 0x%x)", timestamp, sck, sdio0, sdio1, sdio2, sdio3, mask);
 
+  this->handle_sck_edge(timestamp, sck, Dpi_spi_shifter::pack(sdio0, sdio1, sdio2, sdio3));
+}
+
+void Spiram::octal_sck_edge(int64_t timestamp, int sck, int data, int mask)
+{
+  if (this->refresh_failure)
+    return;
+
+  this->trace_msg(this->trace, 4, "SCK edge (timestamp: %ld, sck: %d, data: 0x%2.2x, mask: 0x%x)", timestamp, sck, data, mask);
+
+  this->handle_sck_edge(timestamp, sck, data);
+}
+
+// Data is sampled on rising edges and driven on falling edges, except in
+// octal DTR mode where both are done on both edges. Dummy cycles are counted
+// at the end of the cycle, i.e. on rising edges, or on falling edges in
+// octal DTR mode.
+void Spiram::handle_sck_edge(int64_t timestamp, int sck, int lanes)
+{
+  // The first data is driven on the edge following the end of the previous
+  // phase
+  bool reading = this->state == STATE_GET_DATA && !this->is_write;
+
   if (prev_sck == 1 && !sck)
   {
-    handle_clk_low(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
+    if (this->dopi)
+      this->handle_clk_high(timestamp, lanes);
+    if (reading)
+      this->handle_clk_low(timestamp);
   }
   else if (prev_sck == 0 && sck)
   {
-    handle_clk_high(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
+    if (this->dopi)
+    {
+      this->sample(timestamp, lanes);
+      if (reading)
+        this->handle_clk_low(timestamp);
+    }
+    else
+    {
+      this->handle_clk_high(timestamp, lanes);
+    }
   }
   prev_sck = sck;
 }
@@ -19,6 +19,8 @@
  */
 
 #include "dpi/models.hpp"
+#include "dpi/mem.hpp"
+#include "dpi/spi_shifter.hpp"
 #include <stdint.h>
 #include <vector>
 
@@ -71,6 +73,7 @@ public:
   void sck_edge(int64_t timestamp, int sck, int data_0, int data_1, int data_2, int data_3, int mask);
   void edge(int64_t timestamp, int data_0, int data_1, int data_2, int data_3, int mask);
   void cs_edge(int64_t timestamp, int cs);
+  int transfer(int64_t timestamp, Qspi_transfer *transfer);
 
 private:
     Spim_verif *top;
@@ -118,8 +121,11 @@ protected:
   void sck_edge(int64_t timestamp, int sck, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
   void edge(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
   void cs_edge(int64_t timestamp, int cs);
+  int transfer(int64_t timestamp, Qspi_transfer *transfer);
   void handle_clk_high(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
   void handle_clk_low(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sdio3, int mask);
+  void start();
+  void stop();
 
 
 private:
@@ -134,15 +140,16 @@ private:
 
   void exec_write(int data);
   void exec_read();
-  void exec_dump_single(int sdio0);
-  void exec_dump_qpi(int sdio0, int sdio1, int sdio2, int sdio3);
+  void exec_dump(int lanes);
+  void set_data(int bit);
+  void transfer_bits(int64_t timestamp, uint64_t value, int bits, int lanes);
 
   void handle_command(uint64_t cmd);
 
   Spim_verif_state_e state = STATE_GET_CMD;
   uint64_t current_cmd = 0;
   int prev_sck = 0;
-  int cmd_count = 0;
+  Dpi_spi_shifter cmd_rx;
   int dummy_cycles = 0;
   bool wait_cs;
   int command_addr;
@@ -150,7 +157,7 @@ private:
   int current_write_addr;
   int current_size;
   int current_write_size;
-  unsigned char *data;
+  Dpi_mem *mem;
   int nb_bits;
   int nb_write_bits;
   uint32_t byte;
@@ -158,10 +165,13 @@ private:
   unsigned int pending_write;
   int current_cs;
   FILE *tx_file;
-  int tx_dump_bits;
-  bool tx_dump_qpi;
-  int tx_dump_byte;
+  Dpi_spi_shifter tx_dump;
   int mem_size;
+  // When a transfer is being executed, the output bits are stored here
+  // instead of being sent to the testbench
+  uint8_t *capture_data = NULL;
+  int capture_bits;
+  int capture_size;
 
   void *trace;
 };
@@ -176,6 +186,7 @@ Spim_verif_gpio_handler::Spim_verif_gpio_handler(Spim_verif *top, int gpio, int
 void Spim_verif_gpio_handler::gpio_handler_stub(Spim_verif_gpio_handler *_this)
 {
   _this->top->gpio_handler(_this->gpio, _this->value);
+  delete _this;
 }
 
 Spim_verif::Spim_verif(js::config *config, void *handle) : Dpi_model(config, handle)
@@ -183,7 +194,8 @@ Spim_verif::Spim_verif(js::config *config, void *handle) : Dpi_model(config, han
   this->mem_size = config->get("mem_size")->get_int();
   verbose = true; //config->get("verbose")->get_bool();
   print("Creating SPIM VERIF model (mem_size: 0x%x)", this->mem_size);
-  data = new unsigned char[mem_size];
+  this->mem = new Dpi_mem(this->mem_size);
+  this->set_backdoor_mem(this->mem);
   qspi0 = new Spim_verif_qspi_itf(this);
   create_itf("input", static_cast<Dpi_itf *>(qspi0));
 
@@ -200,6 +212,7 @@ Spim_verif::Spim_verif(js::config *config, void *handle) : Dpi_model(config, han
 
   wait_cs = false;
   this->current_cs = 1;
+  this->cmd_rx.start(64, 1);
   this->tx_file = NULL;
 
   js::config *tx_file_config = config->get("tx_file");
@@ -207,14 +220,25 @@ Spim_verif::Spim_verif(js::config *config, void *handle) : Dpi_model(config, han
   {
     js::config *path_config = tx_file_config->get("path");
     js::config *qpi_config = tx_file_config->get("qpi");
-    this->tx_dump_bits = 0;
     this->tx_file = fopen(path_config->get_str().c_str(), "wb");
-    this->tx_dump_qpi = qpi_config != NULL && qpi_config->get_bool();
+    this->tx_dump.start(8, qpi_config != NULL && qpi_config->get_bool() ? 4 : 1);
   }
 
   this->trace = this->trace_new(config->get_child_str("name").c_str());
 }
 
+void Spim_verif::start()
+{
+  if (this->mem->preload_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
+}
+
+void Spim_verif::stop()
+{
+  if (this->mem->dump_from_config(this->get_config()))
+    this->print("WARNING: %s", this->mem->get_error().c_str());
+}
+
 void Spim_verif::handle_read(uint64_t cmd)
 {
   int size = SPIM_VERIF_FIELD_GET(cmd, SPIM_VERIF_CMD_INFO_BIT, SPIM_VERIF_CMD_INFO_WIDTH);
@@ -298,7 +322,8 @@ void Spim_verif::exec_read()
     }
     else
     {
-      byte = data[current_addr];
+      byte = this->mem->read(current_addr);
+      this->qspi0->stats_bytes(1);
       this->trace_msg(this->trace, 4, "Read byte from memory (value: 0x%x, rem_size: 0x%x)", byte, current_size);
     }
     nb_bits = 8;
@@ -308,7 +333,7 @@ void Spim_verif::exec_read()
   int bit = (byte >> 7) & 1;
   byte <<= 1;
 
-  qspi0->set_data(bit);
+  this->set_data(bit);
 
   nb_bits--;
   current_size--;
@@ -334,9 +359,10 @@ void Spim_verif::exec_write(int val)
     }
     else
     {
-      data[current_write_addr] = pending_write;
+      this->mem->write(current_write_addr, pending_write);
+      this->qspi0->stats_bytes(1);
 
-      this->trace_msg(this->trace, 4, "Wrote byte to memory (addr: 0x%x, value: 0x%x, rem_size: 0x%x)", current_write_addr, data[current_write_addr], current_write_size-1);
+      this->trace_msg(this->trace, 4, "Wrote byte to memory (addr: 0x%x, value: 0x%x, rem_size: 0x%x)", current_write_addr, this->mem->read(current_write_addr), current_write_size-1);
     }
 
     nb_write_bits = 0;
@@ -349,8 +375,9 @@ void Spim_verif::exec_write(int val)
     if (nb_write_bits != 0)
     {
       int shift = 8 - nb_write_bits;
-      pending_write = (data[current_write_addr] & ~((1<<shift) - 1)) | (pending_write << shift);
-      this->trace_msg(this->trace, 4, "Wrote byte to memory (value: 0x%x)", data[current_write_addr]);
+      uint8_t prev_data = this->mem->check_range(current_write_addr) ? this->mem->read(current_write_addr) : 0;
+      pending_write = (prev_data & ~((1<<shift) - 1)) | (pending_write << shift);
+      this->trace_msg(this->trace, 4, "Wrote byte to memory (value: 0x%x)", prev_data);
     }
     wait_cs = true;
     state = STATE_GET_CMD;
@@ -363,6 +390,8 @@ void Spim_verif::handle_command(uint64_t cmd)
 
   int cmd_id = SPIM_VERIF_FIELD_GET(cmd, SPIM_VERIF_CMD_BIT, SPIM_VERIF_CMD_WIDTH);
 
+  this->qspi0->stats_command(cmd_id);
+
   switch (cmd_id) {
     case SPIM_VERIF_CMD_WRITE: handle_write(cmd); break;
     case SPIM_VERIF_CMD_READ: handle_read(cmd); break;
@@ -394,6 +423,69 @@ void Spim_verif_qspi_itf::edge(int64_t timestamp, int data_0, int data_1, int da
   top->edge(timestamp, data_0, data_1, data_2, data_3, mask);
 }
 
+int Spim_verif_qspi_itf::transfer(int64_t timestamp, Qspi_transfer *transfer)
+{
+  return top->transfer(timestamp, transfer);
+}
+
+void Spim_verif::set_data(int bit)
+{
+  if (this->capture_data)
+  {
+    if (this->capture_bits < this->capture_size)
+    {
+      this->capture_data[this->capture_bits / 8] |= bit << (7 - (this->capture_bits % 8));
+      this->capture_bits++;
+    }
+  }
+  else
+  {
+    this->qspi0->set_data(bit);
+  }
+}
+
+void Spim_verif::transfer_bits(int64_t timestamp, uint64_t value, int bits, int lanes)
+{
+  for (int i=bits-lanes; i>=0; i-=lanes)
+  {
+    int data = (value >> i) & ((1 << lanes) - 1);
+    this->handle_clk_high(timestamp, (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, 0xf);
+    this->handle_clk_low(timestamp, (data >> 0) & 1, (data >> 1) & 1, (data >> 2) & 1, (data >> 3) & 1, 0xf);
+  }
+}
+
+int Spim_verif::transfer(int64_t timestamp, Qspi_transfer *transfer)
+{
+  this->trace_msg(this->trace, 3, "Transfer (timestamp: %ld, cmd: 0x%lx, is_write: %d, size: %d)", timestamp, transfer->cmd, transfer->is_write, transfer->size);
+
+  // The command protocol is bit-oriented, so the transfer is replayed on the
+  // clock handlers, but within the model, without going through the DPI layer
+  if (!transfer->is_write)
+  {
+    this->capture_data = transfer->data;
+    this->capture_bits = 0;
+    this->capture_size = transfer->size * 8;
+    memset(transfer->data, 0, transfer->size);
+  }
+
+  this->cs_edge(timestamp, 0);
+
+  this->transfer_bits(timestamp, transfer->cmd, transfer->cmd_bits, transfer->cmd_lanes);
+  this->transfer_bits(timestamp, transfer->addr, transfer->addr_bits, transfer->addr_lanes);
+  this->transfer_bits(timestamp, 0, transfer->dummy_cycles, 1);
+
+  for (int i=0; i<transfer->size; i++)
+  {
+    this->transfer_bits(timestamp, transfer->is_write ? transfer->data[i] : 0, 8, transfer->data_lanes);
+  }
+
+  this->capture_data = NULL;
+
+  this->cs_edge(timestamp + transfer->get_duration(), 1);
+
+  return 0;
+}
+
 void Spim_verif::cs_edge(int64_t timestamp, int cs)
 {
   if (this->current_cs == cs) return;
@@ -427,25 +519,12 @@ void Spim_verif::edge(int64_t timestamp, int sdio0, int sdio1, int sdio2, int sd
   handle_clk_low(timestamp, sdio0, sdio1, sdio2, sdio3, mask);
 }
 
-void Spim_verif::exec_dump_single(int sdio0)
+void Spim_verif::exec_dump(int lanes)
 {
-  this->tx_dump_byte = (this->tx_dump_byte << 1)| sdio0;
-  this->tx_dump_bits++;
-  if (this->tx_dump_bits == 8)
+  if (this->tx_dump.push(lanes))
   {
-    this->tx_dump_bits = 0;
-    fwrite((void *)&this->tx_dump_byte, 1, 1, this->tx_file);
-  }
-}
-
-void Spim_verif::exec_dump_qpi(int sdio0, int sdio1, int sdio2, int sdio3)
-{
-  this->tx_dump_byte = (this->tx_dump_byte << 4) | (sdio3 << 3) | (sdio2 << 2) | (sdio1 << 1) | sdio0;
-  this->tx_dump_bits += 4;
-  if (this->tx_dump_bits == 8)
-  {
-    this->tx_dump_bits = 0;
-    fwrite((void *)&this->tx_dump_byte, 1, 1, this->tx_file);
+    uint8_t value = this->tx_dump.get();
+    fwrite((void *)&value, 1, 1, this->tx_file);
   }
 }
 
@@ -456,22 +535,17 @@ void Spim_verif::handle_clk_high(int64_t timestamp, int sdio0, int sdio1, int sd
 
   if (this->tx_file != NULL)
   {
-    if (this->tx_dump_qpi)
-      exec_dump_qpi(sdio0, sdio1, sdio2, sdio3);
-    else
-      exec_dump_single(sdio0);
+    exec_dump(Dpi_spi_shifter::pack(sdio0, sdio1, sdio2, sdio3));
     // TODO properly destroy the model and close the logfile instead of flushing
     fflush(NULL);
   }
 
   if (state == STATE_GET_CMD)
   {
-    current_cmd = (current_cmd << 1) | sdio0;
-    this->trace_msg(this->trace, 4, "Received command bit (count: %d, pending: %x, bit: %d)", cmd_count, current_cmd, sdio0);
-    cmd_count++;
-    if (cmd_count == 64)
+    this->trace_msg(this->trace, 4, "Received command bit (count: %d, bit: %d)", this->cmd_rx.get_count(), sdio0);
+    if (this->cmd_rx.push(sdio0))
     {
-      cmd_count = 0;
+      current_cmd = this->cmd_rx.get();
       handle_command(current_cmd);
     }
   }
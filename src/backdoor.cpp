@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dpi/models.hpp"
+#include "dpi/mem.hpp"
+
+// Backdoor accesses to the memory registered by a model, which bypass its
+// interfaces and take no simulated time
+
+static Dpi_mem *backdoor_get(void *handle, uint64_t addr, int size)
+{
+  Dpi_mem *mem = ((Dpi_model *)handle)->get_backdoor_mem();
+  if (mem == NULL || size < 0 || !mem->check_range(addr, size))
+    return NULL;
+  return mem;
+}
+
+int dpi_model_mem_write(void *handle, uint64_t addr, const svOpenArrayHandle data, int size)
+{
+  Dpi_mem *mem = backdoor_get(handle, addr, size);
+  if (mem == NULL)
+    return -1;
+
+  mem->write_block(addr, (uint8_t *)svGetArrayPtr(data), size);
+  return 0;
+}
+
+int dpi_model_mem_read(void *handle, uint64_t addr, const svOpenArrayHandle data, int size)
+{
+  Dpi_mem *mem = backdoor_get(handle, addr, size);
+  if (mem == NULL)
+    return -1;
+
+  mem->read_block(addr, (uint8_t *)svGetArrayPtr(data), size);
+  return 0;
+}
+
+int dpi_model_mem_load_file(void *handle, const char *path, const char *format, uint64_t base)
+{
+  Dpi_mem *mem = ((Dpi_model *)handle)->get_backdoor_mem();
+  if (mem == NULL)
+    return -1;
+
+  return mem->load_file(path, format ? format : "", base);
+}
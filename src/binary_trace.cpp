@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* 
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "dpi/binary_trace.hpp"
+
+Dpi_binary_trace::Dpi_binary_trace(std::string path, int nb_records)
+: header(NULL), records(NULL), nb_records(nb_records), str_file(NULL), nb_str(0)
+{
+  this->map_size = sizeof(dpi_binary_trace_header_t) + sizeof(dpi_binary_trace_record_t) * nb_records;
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return;
+
+  if (ftruncate(fd, this->map_size) == -1)
+  {
+    close(fd);
+    return;
+  }
+
+  void *map = mmap(NULL, this->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+
+  this->str_file = fopen((path + ".str").c_str(), "wb");
+  if (this->str_file == NULL)
+  {
+    munmap(map, this->map_size);
+    return;
+  }
+
+  this->header = (dpi_binary_trace_header_t *)map;
+  this->header->magic = DPI_BINARY_TRACE_MAGIC;
+  this->header->version = DPI_BINARY_TRACE_VERSION;
+  this->header->record_size = sizeof(dpi_binary_trace_record_t);
+  this->header->nb_records = nb_records;
+  this->header->nb_written = 0;
+  this->records = (dpi_binary_trace_record_t *)(this->header + 1);
+}
+
+Dpi_binary_trace::~Dpi_binary_trace()
+{
+  if (this->header)
+  {
+    this->flush();
+    munmap(this->header, this->map_size);
+    fclose(this->str_file);
+  }
+}
+
+void Dpi_binary_trace::flush()
+{
+  if (this->header)
+  {
+    msync(this->header, this->map_size, MS_SYNC);
+    fflush(this->str_file);
+  }
+}
+
+uint32_t Dpi_binary_trace::new_str(const char *str)
+{
+  dpi_binary_trace_str_t desc = { .id=this->nb_str++, .len=(uint32_t)strlen(str) };
+  fwrite(&desc, sizeof(desc), 1, this->str_file);
+  fwrite(str, 1, desc.len, this->str_file);
+  return desc.id;
+}
+
+uint32_t Dpi_binary_trace::get_static_str_id(const char *str)
+{
+  auto it = this->static_strs.find(str);
+  if (it != this->static_strs.end())
+    return it->second;
+
+  uint32_t id = this->new_str(str);
+  this->static_strs[str] = id;
+  return id;
+}
+
+uint32_t Dpi_binary_trace::get_str_id(const char *str)
+{
+  auto it = this->strs.find(str);
+  if (it != this->strs.end())
+    return it->second;
+
+  uint32_t id = this->new_str(str);
+  this->strs[str] = id;
+  return id;
+}
@@ -33,5 +33,6 @@ void *dpi_cpi_bind(void *comp_handle, const char *name, int handle)
 
 void Cpi_itf::edge(int pclk, int href, int vsync, int data)
 {
+  this->stats_edges(1);
   dpi_cpi_edge((int)(long)sv_handle, pclk, href, vsync, data);
 }
\ No newline at end of file
@@ -33,11 +33,13 @@ void *dpi_ctrl_bind(void *comp_handle, const char *name, int handle)
 
 void Ctrl_itf::reset_edge(int reset)
 {
+  this->stats_edges(1);
   dpi_ctrl_reset_edge((int)(long)sv_handle, reset);
 }
 
 
 void Ctrl_itf::config_edge(uint32_t config)
 {
+  this->stats_edges(1);
   dpi_ctrl_config_edge((int)(long)sv_handle, config);
 }
\ No newline at end of file
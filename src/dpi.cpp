@@ -46,6 +46,7 @@
 typedef struct
 {
   void *(*model_load)(void *config, void *handle);
+  int (*model_load_many)(int nb_models, void **configs, void **handles, void **models);
 } libperiph_api_t;
 
 // Part of the JSON configuration that the testbench should use
@@ -59,24 +60,81 @@ static libperiph_api_t *periph_api = NULL;
 
 
 
+// Types of interfaces that can be found on the chip side of a binding.
+// The chip port name is made of the prefix, followed by the interface id
+// and, for some interfaces, by the sub id (e.g. spim0_cs1).
+typedef struct
+{
+  const char *prefix;
+  const char *type;
+  int sub_id_offset;
+} dpi_itf_type_t;
+
+static const dpi_itf_type_t dpi_itf_types[] = {
+  { "spim", "QSPIM", 8 },
+  { "jtag", "JTAG",  0 },
+  { "uart", "UART",  0 },
+  { "cpi",  "CPI",   0 },
+  { "i2c",  "I2C",   0 },
+  { "i2s",  "I2S",   0 },
+  { "ctrl", "CTRL",  0 },
+  { "gpio", "GPIO",  0 },
+  { "hyper", "HYPER", 0 },
+};
+
 class Dpi_comp_Binding
 {
 public:
-  Dpi_comp_Binding(std::string port, std::string chip_port) : port(port), chip_port(chip_port) {}
+  Dpi_comp_Binding(std::string port, std::string chip_port);
 
   std::string port;
   std::string chip_port;
+  const char *itf_type;
+  const char *itf_name;
+  int itf_id;
+  int itf_sub_id;
 };
 
 class Dpi_comp
 {
 public:
   void reg_binding(Dpi_comp_Binding *binding) { bindings.push_back(binding); }
+  std::string name;
+  js::config *config;
   std::vector<Dpi_comp_Binding *> bindings;
 };
 
+// Components and bindings are resolved once when the configuration is set so
+// that the testbench queries are simple array accesses
 static Dpi_comp *dpi_comps = NULL;
-static std::map<std::string, Dpi_comp *> dpi_comps_map;
+
+
+
+Dpi_comp_Binding::Dpi_comp_Binding(std::string port, std::string chip_port)
+: port(port), chip_port(chip_port)
+{
+  this->itf_type = "UNKNOWN";
+  this->itf_name = "UNKNOWN";
+  this->itf_id = 0;
+  this->itf_sub_id = 0;
+
+  for (auto &type: dpi_itf_types)
+  {
+    int len = strlen(type.prefix);
+    if (this->chip_port.compare(0, len, type.prefix) == 0)
+    {
+      this->itf_type = type.type;
+      this->itf_name = this->port.c_str();
+      if ((int)this->chip_port.size() > len)
+        this->itf_id = atoi(&this->chip_port.c_str()[len]);
+      if (type.sub_id_offset && (int)this->chip_port.size() > type.sub_id_offset)
+        this->itf_sub_id = atoi(&this->chip_port.c_str()[type.sub_id_offset]);
+      break;
+    }
+  }
+}
+
+
 
 /*
  * All the following functions are the entry points that the testbench can
@@ -130,53 +188,69 @@ const char *dpi_config_get_str(void *config)
 void *dpi_driver_set_config(void *handle)
 {
   js::config *config = (js::config *)handle;
+  std::map<std::string, Dpi_comp *> dpi_comps_map;
+
   driver_config = config->get("**/system_tree/board");
   js::config *tb_comps_config = driver_config->get("tb_comps");
-  if (tb_comps_config != NULL)
-    driver_nb_comp = tb_comps_config->get_size();
-  return NULL;
-}
-
 
-// Get number of components that the testbench should instantiate
-int dpi_driver_get_nb_comp(void *handle)
-{
-  if (dpi_comps == NULL && driver_nb_comp != 0) 
+  if (dpi_comps != NULL)
   {
-    dpi_comps = new Dpi_comp[driver_nb_comp];
     for (int i=0; i<driver_nb_comp; i++)
     {
-      js::config *tb_comps_config = driver_config->get("tb_comps");
-      js::config *comp_config = tb_comps_config->get_elem(i);
-      dpi_comps_map[tb_comps_config->get_elem(i)->get_str()] = &dpi_comps[i];
+      for (auto binding: dpi_comps[i].bindings)
+        delete binding;
     }
+    delete[] dpi_comps;
+    dpi_comps = NULL;
+  }
+
+  driver_nb_comp = tb_comps_config != NULL ? tb_comps_config->get_size() : 0;
+  if (driver_nb_comp == 0)
+    return NULL;
+
+  dpi_comps = new Dpi_comp[driver_nb_comp];
+  for (int i=0; i<driver_nb_comp; i++)
+  {
+    Dpi_comp *comp = &dpi_comps[i];
+    comp->name = tb_comps_config->get_elem(i)->get_str();
+    comp->config = driver_config->get(comp->name);
+    dpi_comps_map[comp->name] = comp;
+  }
 
-    js::config *bindings = driver_config->get("tb_bindings");
+  js::config *bindings = driver_config->get("tb_bindings");
+  if (bindings == NULL)
+    return NULL;
 
-    for (int i=0; i<bindings->get_size(); i++)
+  for (int i=0; i<bindings->get_size(); i++)
+  {
+    js::config *binding = bindings->get_elem(i);
+    std::string master_desc = binding->get_elem(0)->get_str();
+    std::string slave_desc = binding->get_elem(1)->get_str();
+    std::string delimiter = "->";
+    std::string master = master_desc.substr(0, master_desc.find(delimiter));
+    std::string master_port = master_desc.erase(0, master_desc.find(delimiter) + delimiter.length());
+    std::string slave = slave_desc.substr(0, slave_desc.find(delimiter));
+    std::string slave_port = slave_desc.erase(0, slave_desc.find(delimiter) + delimiter.length());
+
+    if (master == "chip")
     {
-      js::config *binding = bindings->get_elem(i);
-      std::string master_desc = binding->get_elem(0)->get_str();
-      std::string slave_desc = binding->get_elem(1)->get_str();
-      std::string delimiter = "->";
-      std::string master = master_desc.substr(0, master_desc.find(delimiter));
-      std::string master_port = master_desc.erase(0, master_desc.find(delimiter) + delimiter.length());
-      std::string slave = slave_desc.substr(0, slave_desc.find(delimiter));
-      std::string slave_port = slave_desc.erase(0, slave_desc.find(delimiter) + delimiter.length());
-
-      std::string comp;
-
-      if (master == "chip")
-      {
+      if (dpi_comps_map.find(slave) != dpi_comps_map.end())
         dpi_comps_map[slave]->reg_binding(new Dpi_comp_Binding(slave_port, master_port));
-      }
-      else
-      {
+    }
+    else
+    {
+      if (dpi_comps_map.find(master) != dpi_comps_map.end())
         dpi_comps_map[master]->reg_binding(new Dpi_comp_Binding(master_port, slave_port));
-      }
     }
   }
 
+  return NULL;
+}
+
+
+// Get number of components that the testbench should instantiate
+int dpi_driver_get_nb_comp(void *handle)
+{
   return driver_nb_comp;
 }
 
@@ -184,26 +258,21 @@ int dpi_driver_get_nb_comp(void *handle)
 // Return the name of the given component identified by his index
 const char *dpi_driver_get_comp_name(void *handle, int index)
 {
-  js::config *tb_comps_config = driver_config->get("tb_comps");
-  return strdup(tb_comps_config->get_elem(index)->get_str().c_str());
+  return dpi_comps[index].name.c_str();
 }
 
 
 // Return the JSON configuration of the given component identified by his index
 void *dpi_driver_get_comp_config(void *handle, int index)
 {
-  js::config *tb_comps_config = driver_config->get("tb_comps");
-  const char *comp_name = tb_comps_config->get_elem(index)->get_str().c_str();
-  return driver_config->get(comp_name);
+  return dpi_comps[index].config;
 }
 
 
 // Return the number of interfaces of the given component JSON descriptor
 int dpi_driver_get_comp_nb_itf(void *comp_handle, int index)
 {
-  js::config *comp_config = (js::config *)comp_handle;
-  Dpi_comp *comp = &dpi_comps[index];
-  return comp->bindings.size();
+  return dpi_comps[index].bindings.size();
 }
 
 
@@ -211,123 +280,17 @@ int dpi_driver_get_comp_nb_itf(void *comp_handle, int index)
 void dpi_driver_get_comp_itf_info(void *comp_handle, int index, int itf_index,
   const char **itf_name, const char **itf_type, int *itf_id, int *itf_sub_id)
 {
-  *itf_type = (const char *)"UNKNOWN";
-  *itf_name = (const char *)"UNKNOWN";
-
-  Dpi_comp *comp = &dpi_comps[index];
-  Dpi_comp_Binding *binding = comp->bindings[itf_index];
-  const char *chip_port_name = binding->chip_port.c_str();
-  if (strncmp(chip_port_name, "spim", 4) == 0)
-  {
-    *itf_type = (const char *)"QSPIM";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 4)
-    {
-      *itf_id = atoi(&chip_port_name[4]);
-      *itf_sub_id = atoi(&chip_port_name[8]);
-    }
-  }
-  else if (strncmp(chip_port_name, "jtag", 4) == 0)
-  {
-    *itf_type = (const char *)"JTAG";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 4)
-    {
-      *itf_id = atoi(&chip_port_name[4]);
-      *itf_sub_id = 0;
-    }
-    else
-    {
-      *itf_id = 0;
-      *itf_sub_id = 0;
-    }
-  }
-  else if (strncmp(chip_port_name, "uart", 4) == 0)
-  {
-    *itf_type = (const char *)"UART";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 4)
-    {
-      *itf_id = atoi(&chip_port_name[4]);
-      *itf_sub_id = 0;
-    }
-    else
-    {
-      *itf_id = 0;
-      *itf_sub_id = 0;
-    }
-  }
-  else if (strncmp(chip_port_name, "cpi", 3) == 0)
-  {
-    *itf_type = (const char *)"CPI";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 3)
-    {
-      *itf_id = atoi(&chip_port_name[3]);
-      *itf_sub_id = 0;
-    }
-    else
-    {
-      *itf_id = 0;
-      *itf_sub_id = 0;
-    }
-  }
-  else if (strncmp(chip_port_name, "i2c", 3) == 0)
-  {
-    *itf_type = (const char *)"I2C";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 3)
-    {
-      *itf_id = atoi(&chip_port_name[3]);
-      *itf_sub_id = 0;
-    }
-    else
-    {
-      *itf_id = 0;
-      *itf_sub_id = 0;
-    }
-  }
-  else if (strncmp(chip_port_name, "i2s", 3) == 0)
-  {
-    *itf_type = (const char *)"I2S";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 3)
-    {
-      *itf_id = atoi(&chip_port_name[3]);
-      *itf_sub_id = 0;
-    }
-    else
-    {
-      *itf_id = 0;
-      *itf_sub_id = 0;
-    }
-  }
-  else if (strncmp(chip_port_name, "ctrl", 4) == 0)
-  {
-    *itf_type = (const char *)"CTRL";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 4)
-    {
-      *itf_id = atoi(&chip_port_name[4]);
-      *itf_sub_id = 0;
-    }
-  }
-  else if (strncmp(chip_port_name, "gpio", 4) == 0)
-  {
-    *itf_type = (const char *)"GPIO";
-    *itf_name = strdup(binding->port.c_str());
-    if (strlen(chip_port_name) > 4)
-    {
-      *itf_id = atoi(&chip_port_name[4]);
-      *itf_sub_id = 0;
-    }
-  }
+  Dpi_comp_Binding *binding = dpi_comps[index].bindings[itf_index];
+  *itf_name = binding->itf_name;
+  *itf_type = binding->itf_type;
+  *itf_id = binding->itf_id;
+  *itf_sub_id = binding->itf_sub_id;
 }
 
 
 
-// Load the DPI model for the specified component JSON descriptor
-void *dpi_model_load(void *config, void *handle)
+// Open the library managing DPI models, if not already done
+static libperiph_api_t *periph_api_get()
 {
   // Due to the limitations of questasim on dynamic symbols (see note at the
   // top), we have to dynamically load the library managing DPI models).
@@ -351,13 +314,42 @@ void *dpi_model_load(void *config, void *handle)
       return NULL;
     }
 
+    api->model_load_many = (int (*)(int nb_models, void **configs, void **handles, void **models))dlsym(libperiph, "model_load_many");
+    if (api->model_load_many == NULL)
+    {
+      dpi_print(NULL, "ERROR, didn't find symbol model_load_many in Pulp periph models library");
+      return NULL;
+    }
+
     periph_api = api;
   }
 
-  void *result = periph_api->model_load(config, handle);
+  return periph_api;
+}
+
+
+// Load the DPI model for the specified component JSON descriptor
+void *dpi_model_load(void *config, void *handle)
+{
+  libperiph_api_t *api = periph_api_get();
+  if (api == NULL)
+    return NULL;
+
+  void *result = api->model_load(config, handle);
   return result;
 }
 
+
+// Load the DPI models for several component JSON descriptors at once
+int dpi_model_load_many(int nb_models, const svOpenArrayHandle configs, const svOpenArrayHandle handles, const svOpenArrayHandle models)
+{
+  libperiph_api_t *api = periph_api_get();
+  if (api == NULL)
+    return -1;
+
+  return api->model_load_many(nb_models, (void **)svGetArrayPtr(configs), (void **)svGetArrayPtr(handles), (void **)svGetArrayPtr(models));
+}
+
 int dpi_model_start(void *handle)
 {
   Dpi_model *model = (Dpi_model *)handle;
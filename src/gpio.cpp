@@ -28,6 +28,8 @@
 void dpi_gpio_edge(void *handle, int64_t timestamp, int data)
 {
   Gpio_itf *itf = static_cast<Gpio_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
   itf->edge(timestamp, data);
 }
 
@@ -39,5 +41,6 @@ void *dpi_gpio_bind(void *comp_handle, const char *name, int handle)
 
 void Gpio_itf::set_data(int data)
 {
+  this->stats_edges(1);
   dpi_gpio_set_data((int)(long)sv_handle, data);
 }
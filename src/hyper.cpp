@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dpi/models.hpp"
+
+int dpi_hyper_cs_edge(void *handle, int64_t timestamp, int cs)
+{
+  Hyper_itf *itf = static_cast<Hyper_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
+  if (cs == 0)
+    itf->stats_transaction();
+  itf->cs_edge(timestamp, cs);
+  return 0;
+}
+
+int dpi_hyper_ck_edge(void *handle, int64_t timestamp, int ck, int rwds, int data, int mask)
+{
+  Hyper_itf *itf = static_cast<Hyper_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
+  itf->ck_edge(timestamp, ck, rwds, data, mask);
+  return 0;
+}
+
+void dpi_hyper_edge(void *handle, int64_t timestamp, int rwds, int data, int mask)
+{
+  Hyper_itf *itf = static_cast<Hyper_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
+  itf->edge(timestamp, rwds, data, mask);
+}
+
+int dpi_hyper_ck_edges(void *handle, const svOpenArrayHandle timestamps, const svOpenArrayHandle pins, int nb_edges, int mask, const svOpenArrayHandle out)
+{
+  Hyper_itf *itf = static_cast<Hyper_itf *>((Dpi_itf *)handle);
+  int64_t *timestamp = (int64_t *)svGetArrayPtr(timestamps);
+  uint16_t *pin = (uint16_t *)svGetArrayPtr(pins);
+  int *out_data = out ? (int *)svGetArrayPtr(out) : NULL;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(nb_edges);
+
+  for (int i=0; i<nb_edges; i++)
+  {
+    itf->batch_set(out_data ? &out_data[i] : NULL);
+    itf->ck_edge(timestamp[i], (pin[i] >> 9) & 1, (pin[i] >> 8) & 1, pin[i] & 0xff, mask);
+  }
+  itf->batch_set(NULL);
+
+  return nb_edges;
+}
+
+int dpi_hyper_transfer(void *handle, int64_t timestamp, int64_t period, uint64_t cmd_addr, int size, const svOpenArrayHandle data)
+{
+  Hyper_itf *itf = static_cast<Hyper_itf *>((Dpi_itf *)handle);
+  Hyper_transfer transfer;
+
+  transfer.period = period;
+  transfer.cmd_addr = cmd_addr;
+  transfer.size = size;
+  transfer.data = (uint8_t *)svGetArrayPtr(data);
+  transfer.latency = 0;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_transaction();
+
+  if (itf->transfer(timestamp, &transfer))
+    return -1;
+
+  return transfer.latency;
+}
+
+void *dpi_hyper_bind(void *comp_handle, const char *name, int handle)
+{
+  Dpi_model *model = (Dpi_model *)comp_handle;
+  return model->bind_itf(name, (void *)(long)handle);
+}
+
+void Hyper_itf::set_data(int rwds, int data, int mask)
+{
+  this->stats_edges(1);
+  if (this->batch_push((mask ? HYPER_BATCH_DATA | (data & 0xff) : 0) | (rwds << 8)))
+    return;
+  dpi_hyper_set_data((int)(long)sv_handle, rwds, data, mask);
+}
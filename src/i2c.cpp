@@ -28,9 +28,31 @@
 void dpi_i2c_edge(void *handle, int64_t timestamp, int scl, int sda)
 {
   I2c_itf *itf = static_cast<I2c_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
   itf->tx_edge(timestamp, scl, sda);
 }
 
+int dpi_i2c_edges(void *handle, const svOpenArrayHandle timestamps, const svOpenArrayHandle pins, int nb_edges, const svOpenArrayHandle out)
+{
+  I2c_itf *itf = static_cast<I2c_itf *>((Dpi_itf *)handle);
+  int64_t *timestamp = (int64_t *)svGetArrayPtr(timestamps);
+  uint8_t *pin = (uint8_t *)svGetArrayPtr(pins);
+  int *out_data = out ? (int *)svGetArrayPtr(out) : NULL;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(nb_edges);
+
+  for (int i=0; i<nb_edges; i++)
+  {
+    itf->batch_set(out_data ? &out_data[i] : NULL);
+    itf->tx_edge(timestamp[i], (pin[i] >> 0) & 1, (pin[i] >> 1) & 1);
+  }
+  itf->batch_set(NULL);
+
+  return nb_edges;
+}
+
 void *dpi_i2c_bind(void *comp_handle, const char *name, int handle)
 {
   Dpi_model *model = (Dpi_model *)comp_handle;
@@ -39,5 +61,8 @@ void *dpi_i2c_bind(void *comp_handle, const char *name, int handle)
 
 void I2c_itf::rx_edge(int sda)
 {
+  this->stats_edges(1);
+  if (this->batch_push(sda))
+    return;
   dpi_i2c_rx_edge((int)(long)sv_handle, sda);
 }
\ No newline at end of file
@@ -33,5 +33,6 @@ void *dpi_jtag_bind(void *comp_handle, const char *name, int handle)
 
 void Jtag_itf::tck_edge(int tck, int tdi, int tms, int trst, int *tdo)
 {
+  this->stats_edges(1);
   dpi_jtag_tck_edge((int)(long)sv_handle, tck, tdi, tms, trst, tdo);
 }
\ No newline at end of file
@@ -0,0 +1,479 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* 
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include "dpi/models.hpp"
+#include "dpi/kernel.hpp"
+
+extern "C" void *model_load(void *_config, void *handle);
+extern "C" int model_load_many(int nb_models, void **configs, void **handles, void **models);
+
+// Only one kernel can exist at a time as the imported functions are global
+static Dpi_kernel *kernel = NULL;
+
+typedef std::vector<std::pair<Dpi_kernel_task *, uint64_t>> Dpi_kernel_waiters;
+
+class Dpi_kernel_comp
+{
+public:
+  Dpi_kernel_comp(std::string name) : name(name) {}
+  std::string name;
+  Dpi_kernel_waiters event_waiters;
+  Dpi_kernel_waiters task_event_waiters;
+};
+
+class Dpi_kernel_task
+{
+public:
+  ucontext_t context;
+  char *stack;
+  int id;
+  bool finished;
+  // Increased each time the task is resumed, so that only the first of the
+  // wake-up sources of a wait (event or timeout) resumes it
+  uint64_t wait_id;
+};
+
+
+
+Dpi_kernel::Dpi_kernel(int64_t stack_size)
+: seq(0), time(0), stack_size(stack_size), failed(false), quiet(false), trace_level(0), current_task(NULL)
+{
+  if (kernel != NULL)
+  {
+    fprintf(stderr, "Only one DPI kernel can be instantiated\n");
+    abort();
+  }
+
+  kernel = this;
+  this->main_context = (void *)new ucontext_t;
+}
+
+Dpi_kernel::~Dpi_kernel()
+{
+  delete (ucontext_t *)this->main_context;
+  kernel = NULL;
+}
+
+void *Dpi_kernel::load_model(js::config *config)
+{
+  js::config *name_config = config->get("name");
+  Dpi_kernel_comp *comp = new Dpi_kernel_comp(name_config ? name_config->get_str() : "model" + std::to_string(this->comps.size()));
+  this->comps.push_back(comp);
+
+  void *model = model_load((void *)config, (void *)comp);
+  if (model)
+    this->models.push_back(model);
+
+  return model;
+}
+
+std::vector<void *> Dpi_kernel::load_models(std::vector<js::config *> configs)
+{
+  int nb_models = configs.size();
+  std::vector<void *> handles(nb_models);
+  std::vector<void *> models(nb_models);
+
+  for (int i=0; i<nb_models; i++)
+  {
+    js::config *name_config = configs[i]->get("name");
+    Dpi_kernel_comp *comp = new Dpi_kernel_comp(name_config ? name_config->get_str() : "model" + std::to_string(this->comps.size()));
+    this->comps.push_back(comp);
+    handles[i] = (void *)comp;
+  }
+
+  // Models loaded before the failure are freed, the testbench gets nothing
+  // rather than a partial set
+  if (model_load_many(nb_models, (void **)configs.data(), handles.data(), models.data()))
+    return std::vector<void *>();
+
+  for (auto model: models)
+  {
+    if (model)
+      this->models.push_back(model);
+  }
+
+  return models;
+}
+
+void *Dpi_kernel::bind(void *model, std::string name, Dpi_kernel_itf *itf)
+{
+  int handle = this->itfs.size();
+  this->itfs.push_back(itf);
+  return ((Dpi_model *)model)->bind_itf(name, (void *)(long)handle);
+}
+
+Dpi_kernel_itf *Dpi_kernel::get_itf(int handle)
+{
+  // Interfaces which were not bound have a random handle
+  if (handle < 0 || handle >= (int)this->itfs.size())
+    return NULL;
+  return this->itfs[handle];
+}
+
+void Dpi_kernel::start()
+{
+  for (auto model: this->models)
+  {
+    ((Dpi_model *)model)->start_all();
+  }
+}
+
+void Dpi_kernel::stop()
+{
+  for (auto model: this->models)
+  {
+    ((Dpi_model *)model)->stop_all();
+  }
+}
+
+void Dpi_kernel::post(int64_t delay, std::function<void()> callback)
+{
+  Dpi_kernel_event event;
+  event.time = this->time + delay;
+  event.seq = this->seq++;
+  event.callback = callback;
+  this->events.push(event);
+}
+
+void Dpi_kernel::check_ext_events()
+{
+  std::unique_lock<std::mutex> lock(this->ext_mutex);
+  for (auto comp: this->ext_events)
+  {
+    this->raise_event(&comp->event_waiters);
+  }
+  this->ext_events.clear();
+}
+
+int64_t Dpi_kernel::run(int64_t duration)
+{
+  int64_t end_time = this->time + duration;
+
+  while (!this->failed)
+  {
+    this->check_ext_events();
+
+    if (this->events.empty() || this->events.top().time > end_time)
+      break;
+
+    Dpi_kernel_event event = this->events.top();
+    this->events.pop();
+
+    this->time = event.time;
+    event.callback();
+  }
+
+  if (!this->failed && this->time < end_time)
+    this->time = end_time;
+
+  return this->time;
+}
+
+void Dpi_kernel::task_entry()
+{
+  Dpi_kernel_task *task = kernel->current_task;
+  dpi_start_task(task->id);
+  task->finished = true;
+}
+
+void Dpi_kernel::create_task(Dpi_kernel_comp *comp, int id)
+{
+  Dpi_kernel_task *task = new Dpi_kernel_task;
+  task->stack = new char[this->stack_size];
+  task->id = id;
+  task->finished = false;
+  task->wait_id = 0;
+
+  getcontext(&task->context);
+  task->context.uc_stack.ss_sp = task->stack;
+  task->context.uc_stack.ss_size = this->stack_size;
+  task->context.uc_link = (ucontext_t *)this->main_context;
+  makecontext(&task->context, &Dpi_kernel::task_entry, 0);
+
+  this->post(0, [=]() { this->resume(task, task->wait_id); });
+}
+
+void Dpi_kernel::resume(Dpi_kernel_task *task, uint64_t wait_id)
+{
+  if (task->wait_id != wait_id)
+    return;
+
+  task->wait_id++;
+
+  Dpi_kernel_task *prev_task = this->current_task;
+  this->current_task = task;
+  swapcontext((ucontext_t *)this->main_context, &task->context);
+  this->current_task = prev_task;
+
+  if (task->finished)
+  {
+    delete[] task->stack;
+    delete task;
+  }
+}
+
+void Dpi_kernel::suspend()
+{
+  Dpi_kernel_task *task = this->current_task;
+
+  if (task == NULL)
+  {
+    fprintf(stderr, "Trying to wait outside of a task\n");
+    abort();
+  }
+
+  swapcontext(&task->context, (ucontext_t *)this->main_context);
+}
+
+void Dpi_kernel::create_periodic_handler(int id, int64_t period)
+{
+  this->post(period, [=]() {
+    dpi_exec_periodic_handler(id);
+    this->create_periodic_handler(id, period);
+  });
+}
+
+void Dpi_kernel::wait(int64_t delay)
+{
+  Dpi_kernel_task *task = this->current_task;
+  uint64_t wait_id = task ? task->wait_id : 0;
+  this->post(delay, [=]() { this->resume(task, wait_id); });
+  this->suspend();
+}
+
+void Dpi_kernel::wait_event(Dpi_kernel_waiters *waiters, int64_t timeout)
+{
+  Dpi_kernel_task *task = this->current_task;
+  uint64_t wait_id = task ? task->wait_id : 0;
+
+  waiters->push_back(std::make_pair(task, wait_id));
+
+  if (timeout >= 0)
+  {
+    this->post(timeout, [=]() { this->resume(task, wait_id); });
+  }
+
+  this->suspend();
+}
+
+void Dpi_kernel::raise_event(Dpi_kernel_waiters *waiters)
+{
+  // Like SystemVerilog events, raising an event with no waiter has no effect
+  for (auto waiter: *waiters)
+  {
+    Dpi_kernel_task *task = waiter.first;
+    uint64_t wait_id = waiter.second;
+    this->post(0, [=]() { this->resume(task, wait_id); });
+  }
+  waiters->clear();
+}
+
+void Dpi_kernel::raise_event_from_ext(Dpi_kernel_comp *comp)
+{
+  std::unique_lock<std::mutex> lock(this->ext_mutex);
+  this->ext_events.push_back(comp);
+}
+
+void Dpi_kernel::print(Dpi_kernel_comp *comp, const char *msg)
+{
+  if (!this->quiet)
+    printf("%s: %s\n", comp ? comp->name.c_str() : "dpi", msg);
+}
+
+void Dpi_kernel::fatal(Dpi_kernel_comp *comp, const char *msg)
+{
+  fprintf(stderr, "%ld: %s: FATAL: %s\n", (long)this->time, comp ? comp->name.c_str() : "dpi", msg);
+  this->failed = true;
+}
+
+void Dpi_kernel::trace_msg(std::string *trace, int level, const char *msg)
+{
+  if (!this->quiet && level <= this->trace_level)
+    printf("%ld: %s: %s\n", (long)this->time, trace->c_str(), msg);
+}
+
+
+
+/*
+ * Functions imported by the models, normally implemented by the testbench
+ */
+
+int64_t dpi_time(void *handle)
+{
+  return kernel->get_time();
+}
+
+int dpi_create_task(void *handle, int id)
+{
+  kernel->create_task((Dpi_kernel_comp *)handle, id);
+  return 0;
+}
+
+int dpi_create_periodic_handler(void *handle, int id, int64_t period)
+{
+  kernel->create_periodic_handler(id, period);
+  return 0;
+}
+
+int dpi_wait(void *handle, int64_t t)
+{
+  kernel->wait(t * 1000);
+  return 0;
+}
+
+int dpi_wait_ps(void *handle, int64_t t)
+{
+  kernel->wait(t);
+  return 0;
+}
+
+int dpi_wait_event(void *handle)
+{
+  kernel->wait_event(&((Dpi_kernel_comp *)handle)->event_waiters, -1);
+  return 0;
+}
+
+int dpi_wait_task_event(void *handle)
+{
+  kernel->wait_event(&((Dpi_kernel_comp *)handle)->task_event_waiters, -1);
+  return 0;
+}
+
+int dpi_wait_task_event_timeout(void *handle, int64_t timeout)
+{
+  kernel->wait_event(&((Dpi_kernel_comp *)handle)->task_event_waiters, timeout);
+  return 0;
+}
+
+int dpi_raise_event(void *handle)
+{
+  kernel->raise_event(&((Dpi_kernel_comp *)handle)->event_waiters);
+  return 0;
+}
+
+int dpi_raise_task_event(void *handle)
+{
+  kernel->raise_event(&((Dpi_kernel_comp *)handle)->task_event_waiters);
+  return 0;
+}
+
+int dpi_raise_event_from_ext(void *handle)
+{
+  kernel->raise_event_from_ext((Dpi_kernel_comp *)handle);
+  return 0;
+}
+
+void dpi_print(void *handle, const char *msg)
+{
+  kernel->print((Dpi_kernel_comp *)handle, msg);
+}
+
+void dpi_fatal(void *handle, const char *msg)
+{
+  kernel->fatal((Dpi_kernel_comp *)handle, msg);
+}
+
+void *dpi_trace_new(void *handle, const char *name)
+{
+  Dpi_kernel_comp *comp = (Dpi_kernel_comp *)handle;
+  return (void *)new std::string(comp->name + "/" + name);
+}
+
+void dpi_trace_msg(void *trace, int level, const char *msg)
+{
+  kernel->trace_msg((std::string *)trace, level, msg);
+}
+
+void dpi_qspim_set_data(int handle, int data)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->qspim_set_data(data);
+}
+
+void dpi_qspim_set_qpi_data(int handle, int data_0, int data_1, int data_2, int data_3, int mask)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->qspim_set_qpi_data(data_0, data_1, data_2, data_3, mask);
+}
+
+void dpi_qspim_set_octal_data(int handle, int data, int mask)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->qspim_set_octal_data(data, mask);
+}
+
+void dpi_hyper_set_data(int handle, int rwds, int data, int mask)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->hyper_set_data(rwds, data, mask);
+}
+
+void dpi_gpio_set_data(int handle, int data)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->gpio_set_data(data);
+}
+
+void dpi_uart_rx_edge(int handle, int data)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->uart_rx_edge(data);
+}
+
+void dpi_i2c_rx_edge(int handle, int sda)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->i2c_rx_edge(sda);
+}
+
+void dpi_i2s_rx_edge(int handle, int sck, int ws, int sd)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->i2s_rx_edge(sck, ws, sd);
+}
+
+void dpi_cpi_edge(int handle, int pclk, int href, int vsync, int data)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->cpi_edge(pclk, href, vsync, data);
+}
+
+void dpi_jtag_tck_edge(int handle, int tck, int tdi, int tms, int trst, int *tdo)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->jtag_tck_edge(tck, tdi, tms, trst, tdo);
+}
+
+void dpi_ctrl_reset_edge(int handle, int reset)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->ctrl_reset_edge(reset);
+}
+
+void dpi_ctrl_config_edge(int handle, int config)
+{
+  Dpi_kernel_itf *itf = kernel->get_itf(handle);
+  if (itf) itf->ctrl_config_edge(config);
+}
@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "dpi/mem.hpp"
+
+Dpi_mem::Dpi_mem(uint64_t size, uint8_t fill, int page_bits)
+: size(size), fill_value(fill), page_bits(page_bits)
+{
+  this->page_mask = (1ULL << page_bits) - 1;
+  uint64_t nb_pages = (size + this->page_mask) >> page_bits;
+  this->pages.resize(nb_pages, NULL);
+  this->page_kind.resize(nb_pages, PAGE_NONE);
+  this->invalid_pages.resize(nb_pages, NULL);
+}
+
+Dpi_mem::~Dpi_mem()
+{
+  for (uint64_t page=0; page<this->pages.size(); page++)
+  {
+    if (this->invalid_pages[page])
+      this->page_revalidate(page);
+
+    if (this->page_kind[page] == PAGE_ALLOCATED)
+      delete[] this->pages[page];
+  }
+
+  for (auto &mapping: this->mappings)
+  {
+    munmap(mapping.first, mapping.second);
+  }
+}
+
+uint64_t Dpi_mem::get_page_size(uint64_t page)
+{
+  return std::min(this->page_mask + 1, this->size - (page << this->page_bits));
+}
+
+// Attach back a page detached by invalidate, with the fill value
+uint8_t *Dpi_mem::page_revalidate(uint64_t page)
+{
+  uint8_t *data = this->invalid_pages[page];
+  memset(data, this->fill_value, this->get_page_size(page));
+  this->pages[page] = data;
+  this->invalid_pages[page] = NULL;
+  return data;
+}
+
+uint8_t *Dpi_mem::page_alloc(uint64_t page)
+{
+  if (this->invalid_pages[page])
+    return this->page_revalidate(page);
+
+  uint8_t *data = new uint8_t[this->page_mask + 1];
+  memset(data, this->fill_value, this->page_mask + 1);
+  this->pages[page] = data;
+  this->page_kind[page] = PAGE_ALLOCATED;
+  return data;
+}
+
+void Dpi_mem::page_release(uint64_t page)
+{
+  if (this->invalid_pages[page])
+    this->page_revalidate(page);
+
+  uint8_t *data = this->pages[page];
+
+  switch (this->page_kind[page])
+  {
+    case PAGE_ALLOCATED:
+      delete[] data;
+      break;
+
+    case PAGE_MAPPED:
+      // Drop the private copy, if any, as the page is not accessed anymore
+      madvise(data, this->page_mask + 1, MADV_DONTNEED);
+      break;
+
+    case PAGE_SHARED:
+      // The file keeps the content, it is just set to the fill value
+      memset(data, this->fill_value, this->get_page_size(page));
+      return;
+
+    default:
+      return;
+  }
+
+  this->pages[page] = NULL;
+  this->page_kind[page] = PAGE_NONE;
+}
+
+void Dpi_mem::read_block(uint64_t addr, uint8_t *data, uint64_t size)
+{
+  while (size)
+  {
+    uint64_t offset = addr & this->page_mask;
+    uint64_t iter_size = std::min(size, this->page_mask + 1 - offset);
+    uint8_t *page = this->pages[addr >> this->page_bits];
+
+    if (page)
+      memcpy(data, &page[offset], iter_size);
+    else
+      memset(data, this->fill_value, iter_size);
+
+    addr += iter_size;
+    data += iter_size;
+    size -= iter_size;
+  }
+}
+
+void Dpi_mem::write_block(uint64_t addr, const uint8_t *data, uint64_t size)
+{
+  while (size)
+  {
+    uint64_t offset = addr & this->page_mask;
+    uint64_t iter_size = std::min(size, this->page_mask + 1 - offset);
+    uint8_t *page = this->pages[addr >> this->page_bits];
+
+    if (page == NULL)
+      page = this->page_alloc(addr >> this->page_bits);
+
+    memcpy(&page[offset], data, iter_size);
+
+    addr += iter_size;
+    data += iter_size;
+    size -= iter_size;
+  }
+
+  if (this->shm)
+    this->shm_modified();
+}
+
+void Dpi_mem::fill(uint64_t addr, uint64_t size, uint8_t value)
+{
+  while (size)
+  {
+    uint64_t page_index = addr >> this->page_bits;
+    uint64_t offset = addr & this->page_mask;
+    uint64_t iter_size = std::min(size, this->page_mask + 1 - offset);
+    uint8_t *page = this->pages[page_index];
+
+    if (value == this->fill_value)
+    {
+      if (offset == 0 && iter_size == this->get_page_size(page_index))
+        this->page_release(page_index);
+      else if (page)
+        memset(&page[offset], value, iter_size);
+    }
+    else
+    {
+      if (page == NULL)
+        page = this->page_alloc(page_index);
+      memset(&page[offset], value, iter_size);
+    }
+
+    addr += iter_size;
+    size -= iter_size;
+  }
+
+  if (this->shm)
+    this->shm_modified();
+}
+
+void Dpi_mem::clear()
+{
+  this->fill(0, this->size, this->fill_value);
+}
+
+void Dpi_mem::invalidate()
+{
+  // Detached pages would still be seen with their old content from the
+  // segment, so it is really cleared
+  if (this->shm)
+  {
+    this->clear();
+    return;
+  }
+
+  for (uint64_t page=0; page<this->pages.size(); page++)
+  {
+    if (this->pages[page])
+    {
+      this->invalid_pages[page] = this->pages[page];
+      this->pages[page] = NULL;
+    }
+  }
+}
+
+int Dpi_mem::map_file(std::string path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1)
+  {
+    this->error = strerror(errno);
+    close(fd);
+    return -1;
+  }
+
+  uint64_t size = std::min((uint64_t)file_stat.st_size, this->size);
+  uint64_t page_size = this->page_mask + 1;
+  uint64_t nb_full_pages = size >> this->page_bits;
+  uint64_t mapped_size = 0;
+
+  // When the backed content is shared with a file, the image can only be
+  // copied into it. Otherwise, the full pages are mapped, which is only
+  // possible if they are made of full host pages.
+  if (!this->persistent && nb_full_pages && page_size % getpagesize() == 0)
+  {
+    mapped_size = nb_full_pages << this->page_bits;
+    void *map = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      mapped_size = 0;
+    }
+    else
+    {
+      this->mappings.push_back(std::pair<void *, size_t>(map, mapped_size));
+      for (uint64_t page=0; page<nb_full_pages; page++)
+      {
+        this->page_release(page);
+        this->pages[page] = (uint8_t *)map + (page << this->page_bits);
+        this->page_kind[page] = PAGE_MAPPED;
+      }
+    }
+  }
+
+  // Whatever could not be mapped is read
+  std::vector<uint8_t> buffer(std::min(size - mapped_size, (uint64_t)1 << 16));
+  for (uint64_t offset=mapped_size; offset<size; offset+=buffer.size())
+  {
+    uint64_t iter_size = std::min(size - offset, (uint64_t)buffer.size());
+    if (pread(fd, buffer.data(), iter_size, offset) != (ssize_t)iter_size)
+    {
+      this->error = "failed to read file";
+      close(fd);
+      return -1;
+    }
+    this->write_block(offset, buffer.data(), iter_size);
+  }
+
+  close(fd);
+
+  return 0;
+}
+
+int Dpi_mem::map_persistent(std::string path)
+{
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1)
+  {
+    this->error = strerror(errno);
+    close(fd);
+    return -1;
+  }
+
+  int created = file_stat.st_size == 0;
+
+  if ((uint64_t)file_stat.st_size < this->size)
+  {
+    std::vector<uint8_t> buffer(1 << 16, this->fill_value);
+    for (uint64_t offset=file_stat.st_size; offset<this->size; offset+=buffer.size())
+    {
+      uint64_t iter_size = std::min((uint64_t)buffer.size(), this->size - offset);
+      if (pwrite(fd, buffer.data(), iter_size, offset) != (ssize_t)iter_size)
+      {
+        this->error = strerror(errno);
+        close(fd);
+        return -1;
+      }
+    }
+  }
+
+  void *map = mmap(NULL, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  this->mappings.push_back(std::pair<void *, size_t>(map, this->size));
+
+  for (uint64_t page=0; page<this->pages.size(); page++)
+  {
+    this->page_release(page);
+    this->pages[page] = (uint8_t *)map + (page << this->page_bits);
+    this->page_kind[page] = PAGE_SHARED;
+  }
+
+  this->persistent = true;
+
+  return created;
+}
+
+int Dpi_mem::map_shm(std::string name)
+{
+  if (this->persistent)
+  {
+    this->error = "content is already shared";
+    return -1;
+  }
+
+  if (name.empty() || name[0] != '/')
+    name = "/" + name;
+
+  // A segment left by a previous simulation is only unlinked, the processes
+  // which still map it keep the old object, and a fresh one is created.
+  // Creating it exclusively ensures it is not shared with another simulation
+  // started at the same time with the same name.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd == -1)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  // The content starts on a host page so that it can be mapped on its own
+  uint64_t data_offset = std::max((uint64_t)getpagesize(), (uint64_t)sizeof(dpi_mem_shm_header_t));
+  uint64_t total_size = data_offset + this->size;
+
+  if (ftruncate(fd, total_size) == -1)
+  {
+    this->error = strerror(errno);
+    close(fd);
+    shm_unlink(name.c_str());
+    return -1;
+  }
+
+  void *map = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    this->error = strerror(errno);
+    shm_unlink(name.c_str());
+    return -1;
+  }
+
+  this->mappings.push_back(std::pair<void *, size_t>(map, total_size));
+
+  dpi_mem_shm_header_t *header = (dpi_mem_shm_header_t *)map;
+  uint8_t *data = (uint8_t *)map + data_offset;
+
+  // Keep what was already written, e.g. by a preload
+  this->read_block(0, data, this->size);
+
+  for (uint64_t page=0; page<this->pages.size(); page++)
+  {
+    this->page_release(page);
+    this->pages[page] = data + (page << this->page_bits);
+    this->page_kind[page] = PAGE_SHARED;
+  }
+
+  header->version = DPI_MEM_SHM_VERSION;
+  header->data_offset = data_offset;
+  header->size = this->size;
+  header->generation = 0;
+  header->pid = getpid();
+  header->fill_value = this->fill_value;
+  __atomic_store_n(&header->magic, DPI_MEM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  this->persistent = true;
+  this->shm = header;
+
+  return 0;
+}
+
+int Dpi_mem::preload_from_config(js::config *config)
+{
+  js::config *preload_conf = config->get("preload_file");
+  if (preload_conf == NULL)
+    return 0;
+
+  js::config *format_conf = config->get("preload_format");
+  js::config *base_conf = config->get("preload_base");
+  std::string path = preload_conf->get_str();
+
+  if (this->load_file(path, format_conf ? format_conf->get_str() : "", base_conf ? base_conf->get_int() : 0))
+  {
+    this->error = "unable to load preload file (path: " + path + ", error: " + this->error + ")";
+    return -1;
+  }
+
+  return 0;
+}
+
+int Dpi_mem::map_shm_from_config(js::config *config)
+{
+  js::config *shm_name_conf = config->get("shm_name");
+  if (shm_name_conf == NULL)
+    return 0;
+
+  std::string name = shm_name_conf->get_str();
+  if (this->map_shm(name))
+  {
+    this->error = "unable to map shared memory (name: " + name + ", error: " + this->error + ")";
+    return -1;
+  }
+
+  return 0;
+}
+
+int Dpi_mem::dump(std::string path)
+{
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == NULL)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  std::vector<uint8_t> buffer(std::min(this->size, (uint64_t)1 << 16));
+  for (uint64_t offset=0; offset<this->size; offset+=buffer.size())
+  {
+    uint64_t iter_size = std::min(this->size - offset, (uint64_t)buffer.size());
+    this->read_block(offset, buffer.data(), iter_size);
+    if (fwrite(buffer.data(), 1, iter_size, file) != iter_size)
+    {
+      this->error = "failed to write file";
+      fclose(file);
+      return -1;
+    }
+  }
+
+  fclose(file);
+
+  return 0;
+}
+
+int Dpi_mem::dump_crc(std::string path, uint64_t region_size)
+{
+  if (region_size == 0)
+  {
+    this->error = "region size must not be 0";
+    return -1;
+  }
+
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == NULL)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  fprintf(file, "{\n  \"size\": %lu,\n  \"region_size\": %lu,\n  \"crc32\": [", (unsigned long)this->size, (unsigned long)region_size);
+
+  std::vector<uint8_t> buffer(std::min(region_size, (uint64_t)1 << 16));
+  for (uint64_t region=0; region<this->size; region+=region_size)
+  {
+    uint64_t region_end = std::min(this->size, region + region_size);
+    uint32_t crc = 0;
+
+    for (uint64_t offset=region; offset<region_end; offset+=buffer.size())
+    {
+      uint64_t iter_size = std::min(region_end - offset, (uint64_t)buffer.size());
+      this->read_block(offset, buffer.data(), iter_size);
+      crc = Dpi_mem::crc32(buffer.data(), iter_size, crc);
+    }
+
+    fprintf(file, "%s\n    \"0x%8.8x\"", region == 0 ? "" : ",", crc);
+  }
+
+  fprintf(file, "\n  ]\n}\n");
+
+  if (fclose(file))
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  return 0;
+}
+
+int Dpi_mem::dump_from_config(js::config *config)
+{
+  int result = 0;
+
+  js::config *dump_conf = config->get("dump_file");
+  if (dump_conf != NULL && this->dump(dump_conf->get_str()))
+  {
+    this->error = "unable to dump memory content (path: " + dump_conf->get_str() + ", error: " + this->error + ")";
+    result = -1;
+  }
+
+  js::config *crc_conf = config->get("dump_crc_file");
+  if (crc_conf != NULL)
+  {
+    js::config *region_conf = config->get("dump_crc_region_size");
+    if (this->dump_crc(crc_conf->get_str(), region_conf ? region_conf->get_int() : 4096))
+    {
+      this->error = "unable to dump memory checksums (path: " + crc_conf->get_str() + ", error: " + this->error + ")";
+      result = -1;
+    }
+  }
+
+  return result;
+}
+
+uint32_t Dpi_mem::crc32(const uint8_t *data, uint64_t size, uint32_t crc)
+{
+  // Built on first use, local static initialization being thread-safe
+  static const struct Crc32_table
+  {
+    uint32_t values[256];
+
+    Crc32_table()
+    {
+      for (uint32_t i=0; i<256; i++)
+      {
+        uint32_t value = i;
+        for (int j=0; j<8; j++)
+          value = (value >> 1) ^ (value & 1 ? 0xEDB88320 : 0);
+        this->values[i] = value;
+      }
+    }
+  } table;
+
+  crc = ~crc;
+  for (uint64_t i=0; i<size; i++)
+    crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "dpi/mem.hpp"
+
+// Text images smaller than this are parsed by a single thread
+#define DPI_MEM_IMAGE_CHUNK_SIZE (4 << 20)
+
+
+/*
+ * Parallel parsing helpers
+ */
+
+class Dpi_mem_image_chunk
+{
+public:
+  size_t start;
+  size_t end;
+  std::vector<Dpi_mem_image::Segment> segments;
+  // Offset of the first invalid line, or -1
+  int64_t error_offset = -1;
+
+  // Intel HEX state
+  std::vector<bool> relative;
+  bool has_base = false;
+  uint64_t base = 0;
+  bool eof = false;
+};
+
+// Split the text into chunks ending at line boundaries, one per thread
+static std::vector<Dpi_mem_image_chunk> split_chunks(const char *data, size_t size)
+{
+  size_t nb_chunks = std::max(1U, std::thread::hardware_concurrency());
+  nb_chunks = std::max((size_t)1, std::min(nb_chunks, size / DPI_MEM_IMAGE_CHUNK_SIZE));
+
+  std::vector<Dpi_mem_image_chunk> chunks(nb_chunks);
+  size_t start = 0;
+  for (size_t i=0; i<nb_chunks; i++)
+  {
+    size_t end = i == nb_chunks - 1 ? size : std::max(start, size / nb_chunks * (i + 1));
+    const char *eol = (const char *)memchr(data + end, '\n', size - end);
+    end = eol ? eol - data + 1 : size;
+    chunks[i].start = start;
+    chunks[i].end = end;
+    start = end;
+  }
+
+  return chunks;
+}
+
+static void parse_chunks(std::vector<Dpi_mem_image_chunk> &chunks, std::function<void(Dpi_mem_image_chunk &)> parse)
+{
+  std::vector<std::thread> threads;
+
+  for (size_t i=1; i<chunks.size(); i++)
+  {
+    threads.push_back(std::thread(parse, std::ref(chunks[i])));
+  }
+
+  parse(chunks[0]);
+
+  for (auto &thread: threads)
+  {
+    thread.join();
+  }
+}
+
+static int get_line(const char *data, int64_t offset)
+{
+  return std::count(data, data + offset, '\n') + 1;
+}
+
+static inline int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static inline bool is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Append a byte to the last segment if it is contiguous, or start a new one
+static inline void segment_push(std::vector<Dpi_mem_image::Segment> &segments, uint64_t addr, uint8_t value)
+{
+  if (segments.size() == 0 || segments.back().addr + segments.back().data.size() != addr)
+  {
+    segments.push_back(Dpi_mem_image::Segment());
+    segments.back().addr = addr;
+  }
+  segments.back().data.push_back(value);
+}
+
+// Concatenate the chunk segments, merging the contiguous ones
+static void merge_chunks(std::vector<Dpi_mem_image_chunk> &chunks, std::vector<Dpi_mem_image::Segment> &segments)
+{
+  for (auto &chunk: chunks)
+  {
+    for (auto &segment: chunk.segments)
+    {
+      if (segments.size() && segments.back().addr + segments.back().data.size() == segment.addr)
+      {
+        segments.back().data.insert(segments.back().data.end(), segment.data.begin(), segment.data.end());
+      }
+      else
+      {
+        segments.push_back(std::move(segment));
+      }
+    }
+  }
+}
+
+
+/*
+ * SLM
+ */
+
+static void parse_slm_chunk(const char *data, Dpi_mem_image_chunk &chunk)
+{
+  const char *current = data + chunk.start;
+  const char *end = data + chunk.end;
+
+  while (current < end)
+  {
+    const char *line = current;
+
+    while (current < end && (is_blank(*current) || *current == '\n'))
+      current++;
+
+    if (current == end)
+      break;
+
+    if (*current++ != '@')
+      goto error;
+
+    uint64_t values[2];
+    for (int i=0; i<2; i++)
+    {
+      while (current < end && is_blank(*current))
+        current++;
+
+      int digit, nb_digits = 0;
+      values[i] = 0;
+      while (current < end && (digit = hex_digit(*current)) != -1)
+      {
+        values[i] = (values[i] << 4) | digit;
+        nb_digits++;
+        current++;
+      }
+
+      if (nb_digits == 0)
+        goto error;
+    }
+
+    while (current < end && is_blank(*current))
+      current++;
+
+    if (current < end && *current++ != '\n')
+      goto error;
+
+    segment_push(chunk.segments, values[0], values[1]);
+    continue;
+
+error:
+    chunk.error_offset = line - data;
+    return;
+  }
+}
+
+int Dpi_mem_image::load_slm(const char *data, size_t size)
+{
+  std::vector<Dpi_mem_image_chunk> chunks = split_chunks(data, size);
+
+  parse_chunks(chunks, [data](Dpi_mem_image_chunk &chunk) { parse_slm_chunk(data, chunk); });
+
+  for (auto &chunk: chunks)
+  {
+    if (chunk.error_offset != -1)
+    {
+      this->error = "invalid SLM line " + std::to_string(get_line(data, chunk.error_offset));
+      return -1;
+    }
+  }
+
+  merge_chunks(chunks, this->segments);
+
+  return 0;
+}
+
+
+/*
+ * Intel HEX
+ */
+
+// Each chunk is parsed without knowing the extended address set by the
+// previous chunks. Data records found before the first extended address
+// record of a chunk are marked as relative and are rebased once all chunks
+// are parsed.
+static void parse_hex_chunk(const char *data, Dpi_mem_image_chunk &chunk)
+{
+  const char *current = data + chunk.start;
+  const char *end = data + chunk.end;
+  uint8_t record[5 + 255];
+
+  while (current < end && !chunk.eof)
+  {
+    const char *line = current;
+
+    while (current < end && (is_blank(*current) || *current == '\n'))
+      current++;
+
+    if (current == end)
+      break;
+
+    if (*current++ != ':')
+      goto error;
+
+    {
+      int nb_bytes = 0;
+      uint8_t checksum = 0;
+      while (current + 1 < end && hex_digit(current[0]) != -1 && hex_digit(current[1]) != -1 && nb_bytes < (int)sizeof(record))
+      {
+        record[nb_bytes] = (hex_digit(current[0]) << 4) | hex_digit(current[1]);
+        checksum += record[nb_bytes++];
+        current += 2;
+      }
+
+      while (current < end && is_blank(*current))
+        current++;
+
+      if ((current < end && *current++ != '\n') || nb_bytes < 5 || nb_bytes != record[0] + 5 || checksum != 0)
+        goto error;
+
+      uint32_t addr = (record[1] << 8) | record[2];
+      uint8_t *record_data = &record[4];
+
+      switch (record[3])
+      {
+        case 0:
+        {
+          uint64_t record_addr = chunk.base + addr;
+          bool relative = !chunk.has_base;
+          if (chunk.segments.size() == 0 || chunk.relative.back() != relative || chunk.segments.back().addr + chunk.segments.back().data.size() != record_addr)
+          {
+            chunk.segments.push_back(Dpi_mem_image::Segment());
+            chunk.segments.back().addr = record_addr;
+            chunk.relative.push_back(relative);
+          }
+          chunk.segments.back().data.insert(chunk.segments.back().data.end(), record_data, record_data + record[0]);
+          break;
+        }
+
+        case 1:
+          chunk.eof = true;
+          break;
+
+        case 2:
+          chunk.has_base = true;
+          chunk.base = ((record_data[0] << 8) | record_data[1]) << 4;
+          break;
+
+        case 4:
+          chunk.has_base = true;
+          chunk.base = (uint64_t)((record_data[0] << 8) | record_data[1]) << 16;
+          break;
+
+        default:
+          // Start addresses are not relevant for a memory
+          break;
+      }
+    }
+    continue;
+
+error:
+    chunk.error_offset = line - data;
+    return;
+  }
+}
+
+int Dpi_mem_image::load_hex(const char *data, size_t size)
+{
+  std::vector<Dpi_mem_image_chunk> chunks = split_chunks(data, size);
+
+  parse_chunks(chunks, [data](Dpi_mem_image_chunk &chunk) { parse_hex_chunk(data, chunk); });
+
+  uint64_t base = 0;
+  for (size_t i=0; i<chunks.size(); i++)
+  {
+    Dpi_mem_image_chunk &chunk = chunks[i];
+
+    if (chunk.error_offset != -1)
+    {
+      this->error = "invalid HEX record at line " + std::to_string(get_line(data, chunk.error_offset));
+      return -1;
+    }
+
+    for (size_t j=0; j<chunk.segments.size(); j++)
+    {
+      if (chunk.relative[j])
+        chunk.segments[j].addr += base;
+    }
+
+    if (chunk.has_base)
+      base = chunk.base;
+
+    // Everything after the end of file record is ignored
+    if (chunk.eof)
+    {
+      chunks.resize(i + 1);
+      break;
+    }
+  }
+
+  merge_chunks(chunks, this->segments);
+
+  return 0;
+}
+
+
+/*
+ * ELF
+ */
+
+template<class Ehdr, class Phdr> static int load_elf_segments(const uint8_t *data, size_t size, std::vector<Dpi_mem_image::Segment> &segments, std::string &error)
+{
+  if (size < sizeof(Ehdr))
+  {
+    error = "truncated ELF header";
+    return -1;
+  }
+
+  const Ehdr *ehdr = (const Ehdr *)data;
+
+  if (ehdr->e_phnum && (ehdr->e_phentsize != sizeof(Phdr) || ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Phdr) > size))
+  {
+    error = "invalid ELF program headers";
+    return -1;
+  }
+
+  for (int i=0; i<ehdr->e_phnum; i++)
+  {
+    const Phdr *phdr = (const Phdr *)(data + ehdr->e_phoff + i * sizeof(Phdr));
+
+    if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
+      continue;
+
+    if (phdr->p_offset + (uint64_t)phdr->p_filesz > size || phdr->p_filesz > phdr->p_memsz)
+    {
+      error = "invalid ELF segment " + std::to_string(i);
+      return -1;
+    }
+
+    // The part of the segment which is not in the file (e.g. BSS) is
+    // loaded as zeros
+    segments.push_back(Dpi_mem_image::Segment());
+    segments.back().addr = phdr->p_paddr;
+    segments.back().data.resize(phdr->p_memsz);
+    memcpy(segments.back().data.data(), data + phdr->p_offset, phdr->p_filesz);
+  }
+
+  return 0;
+}
+
+int Dpi_mem_image::load_elf(const uint8_t *data, size_t size)
+{
+  if (size < EI_NIDENT || memcmp(data, ELFMAG, SELFMAG) != 0)
+  {
+    this->error = "not an ELF file";
+    return -1;
+  }
+
+  // Only native endianness is supported, which is the case for the targets
+  // and the hosts we run on
+  if (data[EI_CLASS] == ELFCLASS32)
+    return load_elf_segments<Elf32_Ehdr, Elf32_Phdr>(data, size, this->segments, this->error);
+  else if (data[EI_CLASS] == ELFCLASS64)
+    return load_elf_segments<Elf64_Ehdr, Elf64_Phdr>(data, size, this->segments, this->error);
+
+  this->error = "unsupported ELF class";
+  return -1;
+}
+
+
+/*
+ * Image
+ */
+
+std::string Dpi_mem_image::get_file_format(std::string path)
+{
+  uint8_t header[16];
+  ssize_t size = 0;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd != -1)
+  {
+    size = std::max((ssize_t)0, pread(fd, header, sizeof(header), 0));
+    close(fd);
+  }
+
+  if (size >= SELFMAG && memcmp(header, ELFMAG, SELFMAG) == 0)
+    return "elf";
+
+  size_t dot = path.rfind('.');
+  std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+
+  if (ext == "slm")
+    return "slm";
+  if (ext == "hex" || ext == "ihex" || ext == "ihx")
+    return "hex";
+  if (ext == "bin" || ext == "img")
+    return "bin";
+
+  // Only consider text formats when the first line really looks like one
+  if (size >= 4 && header[0] == '@' && hex_digit(header[1]) != -1)
+    return "slm";
+  if (size >= 11 && header[0] == ':' && std::all_of(&header[1], &header[11], [](uint8_t c) { return hex_digit(c) != -1; }))
+    return "hex";
+
+  return "bin";
+}
+
+int Dpi_mem_image::load(std::string path, std::string format)
+{
+  this->format = format != "" ? format : get_file_format(path);
+
+  if (this->format != "bin" && this->format != "slm" && this->format != "hex" && this->format != "elf")
+  {
+    this->error = "unknown format " + this->format;
+    return -1;
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1)
+  {
+    this->error = strerror(errno);
+    close(fd);
+    return -1;
+  }
+
+  size_t size = file_stat.st_size;
+  if (size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    this->error = strerror(errno);
+    return -1;
+  }
+
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  int err = 0;
+  if (this->format == "slm")
+  {
+    err = this->load_slm((const char *)map, size);
+  }
+  else if (this->format == "hex")
+  {
+    err = this->load_hex((const char *)map, size);
+  }
+  else if (this->format == "elf")
+  {
+    err = this->load_elf((const uint8_t *)map, size);
+  }
+  else
+  {
+    this->segments.push_back(Segment());
+    this->segments.back().addr = 0;
+    this->segments.back().data.assign((const uint8_t *)map, (const uint8_t *)map + size);
+  }
+
+  munmap(map, size);
+
+  return err;
+}
+
+uint64_t Dpi_mem_image::apply(Dpi_mem *mem, uint64_t base)
+{
+  uint64_t nb_dropped = 0;
+
+  for (auto &segment: this->segments)
+  {
+    const uint8_t *data = segment.data.data();
+    uint64_t size = segment.data.size();
+    uint64_t addr = segment.addr;
+
+    if (addr < base)
+    {
+      uint64_t skip = std::min(size, base - addr);
+      nb_dropped += skip;
+      data += skip;
+      size -= skip;
+      addr += skip;
+    }
+
+    addr -= base;
+
+    uint64_t mem_size = mem->get_size();
+    uint64_t iter_size = addr < mem_size ? std::min(size, mem_size - addr) : 0;
+
+    if (iter_size)
+      mem->write_block(addr, data, iter_size);
+
+    nb_dropped += size - iter_size;
+  }
+
+  return nb_dropped;
+}
+
+int Dpi_mem::load_file(std::string path, std::string format, uint64_t base)
+{
+  if (format == "")
+    format = Dpi_mem_image::get_file_format(path);
+
+  if (format == "bin")
+    return this->map_file(path);
+
+  Dpi_mem_image image;
+  if (image.load(path, format))
+  {
+    this->error = image.get_error();
+    return -1;
+  }
+
+  image.apply(this, base);
+
+  return 0;
+}
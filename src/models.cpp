@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <vector>
+#include <map>
 
 #include <json.hpp>
 #include <dlfcn.h>
@@ -92,10 +93,21 @@ void Dpi_model::print(const char *format, ...)
 
 void *Dpi_model::trace_new(const char *name)
 {
-  return dpi_trace_new(this->handle, name);
+  if (this->binary_trace)
+  {
+    int id = this->binary_trace->get_str_id(name);
+    return (void *)new Dpi_trace(NULL, this->trace_level, this->binary_trace, id);
+  }
+
+  return (void *)new Dpi_trace(dpi_trace_new(this->handle, name), this->trace_level, NULL, 0);
+}
+
+void Dpi_model::trace_set_level(void *trace, int level)
+{
+  ((Dpi_trace *)trace)->level = level;
 }
 
-void Dpi_model::trace_msg(void *trace, int level, const char *format, ...)
+void Dpi_model::trace_msg_fmt(void *trace, int level, const char *format, ...)
 {
   int size = 1024;
   while(1)
@@ -107,7 +119,7 @@ void Dpi_model::trace_msg(void *trace, int level, const char *format, ...)
     va_end(ap);
     if (iter_size <= size)
     {
-      dpi_trace_msg(trace, level, str);
+      dpi_trace_msg(((Dpi_trace *)trace)->handle, level, str);
       break;
     }
     size = iter_size;
@@ -149,30 +161,145 @@ void Dpi_model::create_periodic_handler(int64_t period, void *arg1, void *arg2)
   dpi_create_periodic_handler(handle, handler_id, period);
 }
 
-void Dpi_model::create_delayed_handler(int64_t period, void *arg1, void *arg2)
+int64_t Dpi_model::create_delayed_handler(int64_t period, void *arg1, void *arg2)
 {
+  int64_t id = this->scheduler.push(period + dpi_time(this->handle), arg1, arg2);
 
-  Dpi_handler *handler = new Dpi_handler(arg1, arg2, period + dpi_time(this->handle));
+  this->raise_task_event();
 
-  int64_t full_time = period + dpi_time(this->handle);
+  return id;
+}
 
-  Dpi_handler *current = this->first_handler;
-  Dpi_handler *prev = NULL;
+void Dpi_model::cancel_delayed_handler(int64_t id)
+{
+  this->scheduler.cancel(id);
+}
 
-  while (current && current->time < full_time)
+int64_t Dpi_scheduler::push(int64_t time, void *callback, void *arg)
+{
+  int slot;
+
+  if (this->free_slots.size())
+  {
+    slot = this->free_slots.back();
+    this->free_slots.pop_back();
+  }
+  else
   {
-    prev = current;
-    current = current->next;
+    slot = this->handlers.size();
+    this->handlers.push_back(Dpi_handler());
+    this->handlers[slot].generation = 0;
   }
 
-  if (prev)
-    prev->next = handler;
+  Dpi_handler *handler = &this->handlers[slot];
+  handler->callback = callback;
+  handler->arg = arg;
+  handler->time = time;
+  handler->seq = this->seq++;
+  handler->heap_index = this->heap.size();
+
+  this->heap.push_back(slot);
+  this->sift_up(handler->heap_index);
+
+  return ((int64_t)handler->generation << 32) | slot;
+}
+
+bool Dpi_scheduler::cancel(int64_t id)
+{
+  uint32_t slot = id & 0xffffffff;
+  uint32_t generation = id >> 32;
+
+  // The generation is increased each time a slot is released, so that an
+  // id of a handler which was already executed or cancelled is ignored
+  if (slot >= this->handlers.size() || this->handlers[slot].generation != generation)
+    return false;
+
+  this->remove(this->handlers[slot].heap_index);
+  return true;
+}
+
+bool Dpi_scheduler::pop(int64_t time, void **callback, void **arg)
+{
+  if (this->empty() || this->next_time() > time)
+    return false;
+
+  Dpi_handler *handler = &this->handlers[this->heap[0]];
+  *callback = handler->callback;
+  *arg = handler->arg;
+
+  this->remove(0);
+
+  return true;
+}
+
+void Dpi_scheduler::remove(int index)
+{
+  int slot = this->heap[index];
+  int last = this->heap.size() - 1;
+
+  if (index != last)
+  {
+    this->swap(index, last);
+    this->heap.pop_back();
+    this->sift_down(index);
+    this->sift_up(index);
+  }
   else
-    this->first_handler = handler;
+  {
+    this->heap.pop_back();
+  }
+
+  this->handlers[slot].generation++;
+  this->free_slots.push_back(slot);
+}
 
-  handler->next = current;
+bool Dpi_scheduler::before(int slot0, int slot1)
+{
+  Dpi_handler *handler0 = &this->handlers[slot0];
+  Dpi_handler *handler1 = &this->handlers[slot1];
+  return handler0->time < handler1->time || (handler0->time == handler1->time && handler0->seq < handler1->seq);
+}
 
-  this->raise_task_event();
+void Dpi_scheduler::swap(int index0, int index1)
+{
+  int slot = this->heap[index0];
+  this->heap[index0] = this->heap[index1];
+  this->heap[index1] = slot;
+  this->handlers[this->heap[index0]].heap_index = index0;
+  this->handlers[this->heap[index1]].heap_index = index1;
+}
+
+void Dpi_scheduler::sift_up(int index)
+{
+  while (index > 0)
+  {
+    int parent = (index - 1) / 2;
+    if (!this->before(this->heap[index], this->heap[parent]))
+      break;
+    this->swap(index, parent);
+    index = parent;
+  }
+}
+
+void Dpi_scheduler::sift_down(int index)
+{
+  int size = this->heap.size();
+  while (1)
+  {
+    int first = index;
+    int left = 2 * index + 1;
+    int right = left + 1;
+
+    if (left < size && this->before(this->heap[left], this->heap[first]))
+      first = left;
+    if (right < size && this->before(this->heap[right], this->heap[first]))
+      first = right;
+    if (first == index)
+      break;
+
+    this->swap(index, first);
+    index = first;
+  }
 }
 
 int dpi_start_task(int id)
@@ -196,40 +323,77 @@ void Dpi_model::callback_task()
 {
   while(1)
   {
-    Dpi_handler *current = this->first_handler;
-
-    if (!current)
+    if (this->scheduler.empty())
     {
       this->wait_task_event();
     }
     else
     {
       int64_t time = dpi_time(this->handle);
+      void *callback, *arg;
 
-      while (current && time >= current->time)
+      while (this->scheduler.pop(time, &callback, &arg))
       {
-        print("Executing delayed handler");
-        this->first_handler = current->next;
-
-        ((void (*)(void *))current->arg0)(current->arg1);
-
-        delete current;
-        current = this->first_handler;
+        ((void (*)(void *))callback)(arg);
       }
 
-
-      if (this->first_handler)
+      if (!this->scheduler.empty())
       {
-        print("Waiting for next delayed handler (time: %ld)", this->first_handler->time);
-        this->wait_task_event_timeout(this->first_handler->time - time);
+        this->wait_task_event_timeout(this->scheduler.next_time() - time);
       }
     }
   }
 }
 
 Dpi_model::Dpi_model(js::config *config, void *handle)
- : config(config), handle(handle), first_handler(NULL)
+ : config(config), handle(handle)
+{
+  // Messages up to this level are forwarded to the simulator which does the
+  // final filtering. Per-edge messages are only formatted if the component
+  // asks for them, as they would cost a vsnprintf on every edge.
+  js::config *trace_level_config = config ? config->get("trace_level") : NULL;
+  if (trace_level_config)
+    this->trace_level = trace_level_config->get_int();
+  else
+    this->trace_level = DPI_TRACE_DEFAULT_LEVEL;
+
+  // Binary trace mode, messages are dumped into a memory-mapped ring buffer
+  // and decoded offline with dpi_trace_decode
+  this->binary_trace = NULL;
+  js::config *binary_trace_config = config ? config->get("binary_trace") : NULL;
+  if (binary_trace_config)
+  {
+    js::config *nb_records_config = binary_trace_config->get("nb_records");
+    int nb_records = nb_records_config ? nb_records_config->get_int() : 65536;
+    std::string path = binary_trace_config->get_child_str("path");
+
+    if (nb_records <= 0)
+    {
+      this->fatal("Invalid binary trace size (nb_records: %d)", nb_records);
+    }
+    else
+    {
+      this->binary_trace = new Dpi_binary_trace(path, nb_records);
+    }
+
+    if (this->binary_trace && !this->binary_trace->is_open())
+    {
+      this->print("WARNING: failed to open binary trace, falling back to text traces (path: %s)", path.c_str());
+      delete this->binary_trace;
+      this->binary_trace = NULL;
+    }
+  }
+
+  // Interface statistics, dumped when the model is stopped
+  js::config *stats_file_config = config ? config->get("stats_file") : NULL;
+  if (stats_file_config)
+    this->stats_file = stats_file_config->get_str();
+}
+
+Dpi_model::~Dpi_model()
 {
+  if (this->binary_trace)
+    delete this->binary_trace;
 }
 
 void Dpi_model::start_all()
@@ -241,6 +405,49 @@ void Dpi_model::start_all()
 void Dpi_model::stop_all()
 {
   this->stop();
+  if (this->binary_trace)
+    this->binary_trace->flush();
+  if (this->stats_file != "")
+    this->stats_dump();
+}
+
+void Dpi_model::stats_dump()
+{
+  FILE *file = fopen(this->stats_file.c_str(), "w");
+  if (file == NULL)
+  {
+    this->print("WARNING: failed to open stats file (path: %s)", this->stats_file.c_str());
+    return;
+  }
+
+  fprintf(file, "{\n  \"name\": \"%s\",\n  \"interfaces\": {", this->config->get_child_str("name").c_str());
+
+  bool first_itf = true;
+  for (auto &x: this->itfs)
+  {
+    Dpi_itf_stats *stats = x.second->get_stats();
+    if (stats == NULL)
+      continue;
+
+    fprintf(file, "%s\n    \"%s\": {\n", first_itf ? "" : ",", x.first.c_str());
+    fprintf(file, "      \"edges\": %ld,\n", (long)stats->nb_edges);
+    fprintf(file, "      \"transactions\": %ld,\n", (long)stats->nb_transactions);
+    fprintf(file, "      \"bytes\": %ld,\n", (long)stats->nb_bytes);
+    fprintf(file, "      \"callback_time_ns\": %ld,\n", (long)stats->callback_time);
+    fprintf(file, "      \"commands\": {");
+
+    bool first_cmd = true;
+    for (auto &cmd: stats->commands)
+    {
+      fprintf(file, "%s\"0x%x\": %ld", first_cmd ? "" : ", ", cmd.first, (long)cmd.second);
+      first_cmd = false;
+    }
+    fprintf(file, "}\n    }");
+    first_itf = false;
+  }
+
+  fprintf(file, "\n  }\n}\n");
+  fclose(file);
 }
 
 void Dpi_model::wait(int64_t ns)
@@ -308,6 +515,13 @@ void *Dpi_model::bind_itf(std::string name, void *handle)
 void Dpi_model::create_itf(std::string name, Dpi_itf *itf)
 {
   itfs[name] = itf;
+  if (this->stats_file != "")
+    itf->stats_enable();
+}
+
+int64_t Dpi_model::get_time()
+{
+  return dpi_time(this->handle);
 }
 
 js::config *Dpi_model::get_config()
@@ -315,10 +529,20 @@ js::config *Dpi_model::get_config()
   return config;
 }
 
-extern "C" void *model_load(void *_config, void *handle)
+// Model libraries which have already been opened, indexed by path, so that
+// several instances of the same model do not open it again
+class Dpi_module
 {
-  js::config *config = (js::config *)_config;
+public:
+  void *handle;
+  Dpi_model *(*model_new)(js::config *, void *);
+  int (*model_new_many)(int, js::config **, void **, Dpi_model **);
+};
+
+static std::map<std::string, Dpi_module *> dpi_modules;
 
+static Dpi_module *module_get(js::config *config, void *handle)
+{
   js::config *module_config = config->get("module");
 
   if (module_config == NULL)
@@ -329,22 +553,129 @@ extern "C" void *model_load(void *_config, void *handle)
 
   std::string module_name = module_config->get_str();
 
-  void *module = dlopen(module_name.c_str(), RTLD_NOW | RTLD_GLOBAL | RTLD_DEEPBIND);
-  if (module == NULL)
+  auto it = dpi_modules.find(module_name);
+  if (it != dpi_modules.end())
+    return it->second;
+
+  void *module_handle = dlopen(module_name.c_str(), RTLD_NOW | RTLD_GLOBAL | RTLD_DEEPBIND);
+  if (module_handle == NULL)
   {
     dpi_fatal_stub(handle, "ERROR, Failed to open periph model (%s) with error: %s", module_name.c_str(), dlerror());
     return NULL;
   }
 
-  Dpi_model *(*model_new)(js::config *, void *) = (Dpi_model *(*)(js::config *, void *))dlsym(module, "dpi_model_new");
-  if (model_new == NULL)
+  Dpi_module *module = new Dpi_module();
+  module->handle = module_handle;
+  module->model_new = (Dpi_model *(*)(js::config *, void *))dlsym(module_handle, "dpi_model_new");
+  module->model_new_many = (int (*)(int, js::config **, void **, Dpi_model **))dlsym(module_handle, "dpi_model_new_many");
+  if (module->model_new == NULL && module->model_new_many == NULL)
   {
     dpi_fatal_stub(handle, "ERROR, invalid DPI model being loaded (%s)", module_name.c_str());
+    delete module;
+    return NULL;
+  }
+
+  dpi_modules[module_name] = module;
+
+  return module;
+}
+
+extern "C" void *model_load(void *_config, void *handle)
+{
+  js::config *config = (js::config *)_config;
+  Dpi_model *model;
+
+  Dpi_module *module = module_get(config, handle);
+  if (module == NULL)
     return NULL;
+
+  if (module->model_new)
+    return module->model_new(config, handle);
+
+  if (module->model_new_many(1, &config, &handle, &model))
+    return NULL;
+
+  return model;
+}
+
+static int model_load_groups(int nb_models, void **configs, void **handles, void **models)
+{
+  std::map<Dpi_module *, std::vector<int>> groups;
+  std::vector<Dpi_module *> modules;
+
+  for (int i=0; i<nb_models; i++)
+  {
+    Dpi_module *module = module_get((js::config *)configs[i], handles[i]);
+    if (module == NULL)
+      return -1;
+
+    if (groups.find(module) == groups.end())
+      modules.push_back(module);
+    groups[module].push_back(i);
   }
 
-  void *result =  model_new(config, handle);
-  return result;
+  for (auto module: modules)
+  {
+    std::vector<int> &indexes = groups[module];
+    int nb_instances = indexes.size();
+
+    if (module->model_new_many)
+    {
+      std::vector<js::config *> group_configs(nb_instances);
+      std::vector<void *> group_handles(nb_instances);
+      std::vector<Dpi_model *> group_models(nb_instances);
+
+      for (int i=0; i<nb_instances; i++)
+      {
+        group_configs[i] = (js::config *)configs[indexes[i]];
+        group_handles[i] = handles[indexes[i]];
+      }
+
+      if (module->model_new_many(nb_instances, group_configs.data(), group_handles.data(), group_models.data()))
+        return -1;
+
+      for (int i=0; i<nb_instances; i++)
+      {
+        models[indexes[i]] = group_models[i];
+      }
+    }
+    else
+    {
+      for (auto index: indexes)
+      {
+        models[index] = module->model_new((js::config *)configs[index], handles[index]);
+        if (models[index] == NULL)
+          return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Load several models at once. Instances of the same library are created
+// with a single call to dpi_model_new_many when the library provides it, so
+// that they can share their immutable state.
+// On failure, the instances already created are deleted and all the entries
+// of models are NULL.
+extern "C" int model_load_many(int nb_models, void **configs, void **handles, void **models)
+{
+  for (int i=0; i<nb_models; i++)
+  {
+    models[i] = NULL;
+  }
+
+  if (model_load_groups(nb_models, configs, handles, models))
+  {
+    for (int i=0; i<nb_models; i++)
+    {
+      delete (Dpi_model *)models[i];
+      models[i] = NULL;
+    }
+    return -1;
+  }
+
+  return 0;
 }
 
 I2c_slave::I2c_slave(unsigned int address)
@@ -26,6 +26,10 @@
 int dpi_qspim_cs_edge(void *handle, int64_t timestamp, int cs)
 {
   Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
+  if (cs == 0)
+    itf->stats_transaction();
   itf->cs_edge(timestamp, cs);
   return 0;
 }
@@ -33,6 +37,8 @@ int dpi_qspim_cs_edge(void *handle, int64_t timestamp, int cs)
 int dpi_qspim_sck_edge(void *handle, int64_t timestamp, svLogic sck, svLogic data_0, svLogic data_1, svLogic data_2, svLogic data_3, int mask)
 {
   Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
   itf->sck_edge(timestamp, sck, data_0, data_1, data_2, data_3, mask);
   return 0;
 }
@@ -42,9 +48,113 @@ int dpi_qspim_sck_edge(void *handle, int64_t timestamp, svLogic sck, svLogic dat
 void dpi_qspim_edge(void *handle, int64_t timestamp, int data_0, int data_1, int data_2, int data_3, int mask)
 {
   Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
   itf->edge(timestamp, data_0, data_1, data_2, data_3, mask);
 }
 
+int dpi_qspim_octal_sck_edge(void *handle, int64_t timestamp, int sck, int data, int mask)
+{
+  Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
+  itf->octal_sck_edge(timestamp, sck, data, mask);
+  return 0;
+}
+
+void dpi_qspim_octal_edge(void *handle, int64_t timestamp, int data, int mask)
+{
+  Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
+  itf->octal_edge(timestamp, data, mask);
+}
+
+int dpi_qspim_sck_edges(void *handle, const svOpenArrayHandle timestamps, const svOpenArrayHandle pins, int nb_edges, int mask, const svOpenArrayHandle out)
+{
+  Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  int64_t *timestamp = (int64_t *)svGetArrayPtr(timestamps);
+  uint8_t *pin = (uint8_t *)svGetArrayPtr(pins);
+  int *out_data = out ? (int *)svGetArrayPtr(out) : NULL;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(nb_edges);
+
+  for (int i=0; i<nb_edges; i++)
+  {
+    itf->batch_set(out_data ? &out_data[i] : NULL);
+    itf->sck_edge(timestamp[i], (pin[i] >> 4) & 1, (pin[i] >> 0) & 1, (pin[i] >> 1) & 1, (pin[i] >> 2) & 1, (pin[i] >> 3) & 1, mask);
+  }
+  itf->batch_set(NULL);
+
+  return nb_edges;
+}
+
+int dpi_qspim_edges(void *handle, const svOpenArrayHandle timestamps, const svOpenArrayHandle pins, int nb_edges, int mask, const svOpenArrayHandle out)
+{
+  Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  int64_t *timestamp = (int64_t *)svGetArrayPtr(timestamps);
+  uint8_t *pin = (uint8_t *)svGetArrayPtr(pins);
+  int *out_data = out ? (int *)svGetArrayPtr(out) : NULL;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(nb_edges);
+
+  for (int i=0; i<nb_edges; i++)
+  {
+    itf->batch_set(out_data ? &out_data[i] : NULL);
+    itf->edge(timestamp[i], (pin[i] >> 0) & 1, (pin[i] >> 1) & 1, (pin[i] >> 2) & 1, (pin[i] >> 3) & 1, mask);
+  }
+  itf->batch_set(NULL);
+
+  return nb_edges;
+}
+
+int dpi_qspim_octal_sck_edges(void *handle, const svOpenArrayHandle timestamps, const svOpenArrayHandle pins, int nb_edges, int mask, const svOpenArrayHandle out)
+{
+  Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  int64_t *timestamp = (int64_t *)svGetArrayPtr(timestamps);
+  uint16_t *pin = (uint16_t *)svGetArrayPtr(pins);
+  int *out_data = out ? (int *)svGetArrayPtr(out) : NULL;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(nb_edges);
+
+  for (int i=0; i<nb_edges; i++)
+  {
+    itf->batch_set(out_data ? &out_data[i] : NULL);
+    itf->octal_sck_edge(timestamp[i], (pin[i] >> 8) & 1, pin[i] & 0xff, mask);
+  }
+  itf->batch_set(NULL);
+
+  return nb_edges;
+}
+
+int dpi_qspim_transfer(void *handle, int64_t timestamp, int64_t period, uint64_t cmd, int cmd_bits, int cmd_lanes,
+  uint64_t addr, int addr_bits, int addr_lanes, int dummy_cycles, int data_lanes, int is_write, int size, const svOpenArrayHandle data)
+{
+  Qspi_itf *itf = static_cast<Qspi_itf *>((Dpi_itf *)handle);
+  Qspi_transfer transfer;
+
+  transfer.period = period;
+  transfer.cmd = cmd;
+  transfer.cmd_bits = cmd_bits;
+  transfer.cmd_lanes = cmd_lanes > 0 ? cmd_lanes : 1;
+  transfer.addr = addr;
+  transfer.addr_bits = addr_bits;
+  transfer.addr_lanes = addr_lanes > 0 ? addr_lanes : 1;
+  transfer.dummy_cycles = dummy_cycles;
+  transfer.data_lanes = data_lanes > 0 ? data_lanes : 1;
+  transfer.is_write = is_write;
+  transfer.size = size;
+  transfer.data = (uint8_t *)svGetArrayPtr(data);
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_transaction();
+
+  return itf->transfer(timestamp, &transfer);
+}
+
 void *dpi_qspim_bind(void *comp_handle, const char *name, int handle)
 {
   Dpi_model *model = (Dpi_model *)comp_handle;
@@ -53,10 +163,30 @@ void *dpi_qspim_bind(void *comp_handle, const char *name, int handle)
 
 void Qspi_itf::set_data(int data_0)
 {
+  this->stats_edges(1);
+  if (this->batch_push(data_0))
+    return;
   dpi_qspim_set_data((int)(long)sv_handle, data_0);
 }
 
 void Qspi_itf::set_qpi_data(int data_0, int data_1, int data_2, int data_3, int mask)
 {
+  this->stats_edges(1);
+  if (this->batch_push(QSPI_BATCH_QPI | (data_0 << 0) | (data_1 << 2) | (data_2 << 4) | (data_3 << 6)))
+    return;
   dpi_qspim_set_qpi_data((int)(long)sv_handle, data_0, data_1, data_2, data_3, 0xf);
 }
+
+void Qspi_itf::set_octal_data(int data, int mask)
+{
+  this->stats_edges(1);
+  if (this->batch_out)
+  {
+    int value = QSPI_BATCH_OCTAL;
+    for (int i=0; i<8; i++)
+      value |= ((data >> i) & 1) << (i*2);
+    *this->batch_out = value;
+    return;
+  }
+  dpi_qspim_set_octal_data((int)(long)sv_handle, data, mask);
+}
@@ -28,9 +28,31 @@
 void dpi_uart_edge(void *handle, int64_t timestamp, int data)
 {
   Uart_itf *itf = static_cast<Uart_itf *>((Dpi_itf *)handle);
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(1);
   itf->tx_edge(timestamp, data);
 }
 
+int dpi_uart_edges(void *handle, const svOpenArrayHandle timestamps, const svOpenArrayHandle pins, int nb_edges, const svOpenArrayHandle out)
+{
+  Uart_itf *itf = static_cast<Uart_itf *>((Dpi_itf *)handle);
+  int64_t *timestamp = (int64_t *)svGetArrayPtr(timestamps);
+  uint8_t *pin = (uint8_t *)svGetArrayPtr(pins);
+  int *out_data = out ? (int *)svGetArrayPtr(out) : NULL;
+
+  Dpi_itf_stats_scope stats_scope(itf);
+  itf->stats_edges(nb_edges);
+
+  for (int i=0; i<nb_edges; i++)
+  {
+    itf->batch_set(out_data ? &out_data[i] : NULL);
+    itf->tx_edge(timestamp[i], pin[i] & 1);
+  }
+  itf->batch_set(NULL);
+
+  return nb_edges;
+}
+
 void *dpi_uart_bind(void *comp_handle, const char *name, int handle)
 {
   Dpi_model *model = (Dpi_model *)comp_handle;
@@ -39,5 +61,8 @@ void *dpi_uart_bind(void *comp_handle, const char *name, int handle)
 
 void Uart_itf::rx_edge(int data)
 {
+  this->stats_edges(1);
+  if (this->batch_push(data))
+    return;
   dpi_uart_rx_edge((int)(long)sv_handle, data);
 }
\ No newline at end of file
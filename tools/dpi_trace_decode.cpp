@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* 
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+// Rebuilds the text of a binary trace dumped by the models.
+// Usage: dpi_trace_decode <trace file>
+// The string table is read from <trace file>.str
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "dpi/binary_trace.hpp"
+
+static std::vector<std::string> strs;
+
+static const char *get_str(uint64_t id)
+{
+  if (id >= strs.size())
+    return "<unknown>";
+  return strs[id].c_str();
+}
+
+static bool load_strs(std::string path)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+
+  dpi_binary_trace_str_t desc;
+  while (fread(&desc, sizeof(desc), 1, file) == 1)
+  {
+    std::string str(desc.len, 0);
+    if (desc.len && fread(&str[0], 1, desc.len, file) != desc.len)
+      break;
+    if (desc.id >= strs.size())
+      strs.resize(desc.id + 1);
+    strs[desc.id] = str;
+  }
+
+  fclose(file);
+  return true;
+}
+
+// Prints the format string of the record with its arguments, converting each
+// argument according to the conversion specifier which uses it
+static void print_record(dpi_binary_trace_record_t *record)
+{
+  const char *format = get_str(record->format_id);
+  int arg_index = 0;
+  std::string result;
+  char buffer[512];
+
+  auto next_arg = [&](int *type) -> uint64_t {
+    if (arg_index >= record->nb_args)
+    {
+      *type = DPI_BINARY_TRACE_ARG_INT;
+      return 0;
+    }
+    *type = (record->arg_types >> (arg_index * 2)) & 3;
+    return record->args[arg_index++];
+  };
+
+  while (*format)
+  {
+    if (*format != '%')
+    {
+      result += *format++;
+      continue;
+    }
+
+    const char *start = format++;
+    if (*format == '%')
+    {
+      result += '%';
+      format++;
+      continue;
+    }
+
+    std::string spec = "%";
+    int type;
+
+    // Flags, width and precision
+    while (*format && strchr("-+ #0", *format))
+      spec += *format++;
+    while (*format && (*format == '*' || *format == '.' || (*format >= '0' && *format <= '9')))
+    {
+      if (*format == '*')
+        spec += std::to_string((int)next_arg(&type));
+      else
+        spec += *format;
+      format++;
+    }
+
+    // Length modifiers are replaced by the ones matching how the argument is
+    // printed
+    int size = 4;
+    while (*format && strchr("hlLqjzt", *format))
+    {
+      if (*format == 'h')
+        size = size == 2 ? 1 : 2;
+      else
+        size = 8;
+      format++;
+    }
+
+    char conv = *format;
+    if (conv == 0)
+    {
+      result += start;
+      break;
+    }
+    format++;
+
+    uint64_t value = next_arg(&type);
+
+    switch (conv)
+    {
+      case 'd':
+      case 'i': {
+        int64_t svalue = (int64_t)value;
+        if (size == 1) svalue = (int8_t)value;
+        else if (size == 2) svalue = (int16_t)value;
+        else if (size == 4) svalue = (int32_t)value;
+        snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), (long long)svalue);
+        break;
+      }
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        if (size == 1) value = (uint8_t)value;
+        else if (size == 2) value = (uint16_t)value;
+        else if (size == 4) value = (uint32_t)value;
+        snprintf(buffer, sizeof(buffer), (spec + "ll" + conv).c_str(), (unsigned long long)value);
+        break;
+      case 'c':
+        snprintf(buffer, sizeof(buffer), (spec + "c").c_str(), (int)value);
+        break;
+      case 'p':
+        snprintf(buffer, sizeof(buffer), (spec + "p").c_str(), (void *)value);
+        break;
+      case 's':
+        snprintf(buffer, sizeof(buffer), (spec + "s").c_str(), type == DPI_BINARY_TRACE_ARG_STR ? get_str(value) : "<invalid>");
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A': {
+        union { double d; uint64_t u; } fvalue = { .u=value };
+        if (type != DPI_BINARY_TRACE_ARG_DOUBLE)
+          fvalue.d = (double)(int64_t)value;
+        snprintf(buffer, sizeof(buffer), (spec + conv).c_str(), fvalue.d);
+        break;
+      }
+      default:
+        snprintf(buffer, sizeof(buffer), "%s", std::string(start, format - start).c_str());
+    }
+
+    result += buffer;
+  }
+
+  // Messages are printed one per line
+  while (result.size() && result.back() == '\n')
+    result.pop_back();
+
+  printf("%ld: %s: %s\n", (long)record->timestamp, get_str(record->trace_id), result.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+    return -1;
+  }
+
+  std::string path = argv[1];
+
+  if (!load_strs(path + ".str"))
+  {
+    fprintf(stderr, "Unable to open string table: %s.str\n", path.c_str());
+    return -1;
+  }
+
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Unable to open trace file: %s\n", path.c_str());
+    return -1;
+  }
+
+  dpi_binary_trace_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != DPI_BINARY_TRACE_MAGIC
+    || header.version != DPI_BINARY_TRACE_VERSION || header.record_size != sizeof(dpi_binary_trace_record_t))
+  {
+    fprintf(stderr, "Invalid trace file: %s\n", path.c_str());
+    return -1;
+  }
+
+  std::vector<dpi_binary_trace_record_t> records(header.nb_records);
+  if (header.nb_records && fread(records.data(), sizeof(dpi_binary_trace_record_t), header.nb_records, file) != header.nb_records)
+  {
+    fprintf(stderr, "Truncated trace file: %s\n", path.c_str());
+    return -1;
+  }
+  fclose(file);
+
+  // Once the ring has wrapped, the oldest record is the next one to be
+  // overwritten
+  uint64_t nb_valid = header.nb_written < header.nb_records ? header.nb_written : header.nb_records;
+  uint64_t first = header.nb_written - nb_valid;
+
+  for (uint64_t i=0; i<nb_valid; i++)
+  {
+    print_record(&records[(first + i) % header.nb_records]);
+  }
+
+  return 0;
+}